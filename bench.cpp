@@ -0,0 +1,106 @@
+#include <chrono>
+#include <iomanip>
+#include <regex>
+#include <sstream>
+
+#include "textual_tide.h"
+#include "document.h"
+#include "tokenizer.h"
+
+/// @brief The original regex and istringstream based tokenizer, kept as the baseline to beat
+auto legacyTokenize = [](const std::string& inputText) -> std::vector<std::string> {
+    std::regex chapterPattern(R"(CHAPTER (\d+))");
+    std::string processedText = std::regex_replace(inputText, chapterPattern, "CHAPTER_$1");
+
+    std::istringstream stream(processedText);
+    const std::vector<std::string> tokens((std::istream_iterator<std::string>(stream)), std::istream_iterator<std::string>());
+
+    std::vector<std::string> filteredTokens;
+    std::transform(tokens.begin(), tokens.end(), std::back_inserter(filteredTokens), [](const std::string& token) {
+        std::string filtered;
+        std::copy_if(token.begin(), token.end(), std::back_inserter(filtered),
+                     [](char c) { return std::isalpha(c) || std::isdigit(c) || c == '_'; });
+        return filtered;
+    });
+
+    std::vector<std::string> nonEmptyTokens;
+    std::copy_if(filteredTokens.begin(), filteredTokens.end(), std::back_inserter(nonEmptyTokens),
+                 [](const std::string& token) { return !token.empty(); });
+    return nonEmptyTokens;
+};
+
+/// @brief The original countOccurences: a (word, 1) pair per token, reduced into std::unordered_map
+auto legacyCountOccurences = [](const auto& words) {
+    using Word = std::string;
+    std::vector<std::pair<Word, int>> pairs;
+    std::transform(words.begin(), words.end(), std::back_inserter(pairs),
+                   [](std::string_view word) { return std::make_pair(Word(word), 1); });
+    std::unordered_map<Word, int> result;
+    std::for_each(pairs.begin(), pairs.end(), [&result](const std::pair<Word, int>& pair) { result[pair.first] += pair.second; });
+    return result;
+};
+
+/// @brief Best wall time of a few runs of a function
+/// @return Seconds of the fastest run and the token count it reported
+auto bestOf = [](int runs, const auto& function) {
+    double best = 1e9;
+    std::size_t tokenCount = 0;
+    for (int run = 0; run < runs; ++run) {
+        const auto start = std::chrono::steady_clock::now();
+        tokenCount = function();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return std::make_pair(best, tokenCount);
+};
+
+int main(int argc, char* argv[]) {
+    const std::string bookFilename = argc > 1 ? argv[1] : "war_and_peace.txt";
+    const auto book = mapFile(bookFilename);
+    if (!book) {
+        std::cerr << "Cannot open " << bookFilename << std::endl;
+        return 1;
+    }
+    const std::string_view text = book->text();
+    const double megabytes = static_cast<double>(text.size()) / (1024.0 * 1024.0);
+
+    auto report = [megabytes](const std::string& name, const std::pair<double, std::size_t>& result) {
+        std::cout << std::left << std::setw(16) << name << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(10) << result.first * 1000.0 << " ms" << std::setw(10) << megabytes / result.first
+                  << " MB/s" << std::setw(10) << result.second << " tokens" << std::endl;
+    };
+
+    const std::string bookCopy(text);
+    report("regex (legacy)", bestOf(3, [&bookCopy]() { return legacyTokenize(bookCopy).size(); }));
+
+    const auto classifiers = availableClassifiers();
+    std::for_each(classifiers.begin(), classifiers.end(), [&](const auto& classifier) {
+        report("scan " + std::string(classifier.first), bestOf(20, [&]() {
+            std::size_t count = 0;
+            std::string scratch;
+            scanTokensWith(classifier.second, text, true, scratch, [&count](std::string_view, bool) { ++count; });
+            return count;
+        }));
+    });
+
+    report("tokenizeView", bestOf(20, [&text]() { return tokenizeView(text).size(); }));
+
+    // Full vocabulary of every chapter: the tokens column reports the summed distinct words
+    const auto chapteredTokens = tokenizeChapters(text);
+    const auto& ranges = chapteredTokens.chapters.ranges;
+    auto countChapters = [&](const auto& count) {
+        return [&]() {
+            return std::accumulate(ranges.begin(), ranges.end(), std::size_t{0}, [&](std::size_t total, TokenRange range) {
+                return total + count(spanOf(chapteredTokens.tokens, range)).size();
+            });
+        };
+    };
+    report("count (legacy)", bestOf(3, countChapters(legacyCountOccurences)));
+    report("count (flat)", bestOf(10, countChapters(countOccurences)));
+
+    // Vocabulary of the whole book, serial and split across all hardware threads
+    report("count book", bestOf(10, [&]() { return countOccurences(chapteredTokens.tokens).size(); }));
+    ThreadPool pool;
+    report("count book (par)", bestOf(10, [&]() { return countOccurencesParallel(chapteredTokens.tokens, pool).size(); }));
+    return 0;
+}
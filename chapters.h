@@ -0,0 +1,248 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "tokenizer.h"
+
+/// @brief Half-open range [begin, end) of token positions
+struct TokenRange {
+    std::size_t begin = 0;
+    std::size_t end = 0;
+
+    std::size_t size() const { return end - begin; }
+    bool empty() const { return begin == end; }
+};
+
+/// @brief Read-only view of a contiguous part of a token array, nothing is copied
+template <typename T>
+struct Span {
+    using value_type = T;
+
+    const T* first = nullptr;
+    const T* last = nullptr;
+
+    const T* begin() const { return first; }
+    const T* end() const { return last; }
+    std::size_t size() const { return static_cast<std::size_t>(last - first); }
+    bool empty() const { return first == last; }
+    const T& operator[](std::size_t index) const { return first[index]; }
+};
+
+/// @brief View a range of a token array
+/// @param tokens The contiguous token array (tokens, ids, ...)
+/// @param range The positions to view
+/// @return A span over tokens[range.begin, range.end)
+inline auto spanOf = [](const auto& tokens, TokenRange range) {
+    using Token = std::decay_t<decltype(*tokens.begin())>;
+    const Token* data = tokens.empty() ? nullptr : &*tokens.begin();
+    return Span<Token>{data + range.begin, data + range.end};
+};
+
+/// @brief Chapter boundaries as offsets into one contiguous token array
+/// ranges[n] holds the tokens of chapter n without its marker, ranges[0] everything before the
+/// first marker. Chapters without tokens keep an empty range so numbers stay positions.
+struct ChapterIndex {
+    std::vector<TokenRange> ranges;
+
+    /// @brief The number of the last chapter
+    int lastChapter() const { return static_cast<int>(ranges.size()) - 1; }
+};
+
+/// @brief Top level division of a book; chapters before the first heading belong to the front matter
+enum class Part : std::uint8_t { Front = 0, Book = 1, Epilogue = 2 };
+
+inline constexpr std::size_t partCount = 3;
+
+/// @brief A "BOOK <number>" or "<ordinal> EPILOGUE" heading
+struct Heading {
+    /// Position of the first token of the heading
+    std::size_t position = 0;
+    Part part = Part::Book;
+    int number = 0;
+};
+
+/// @brief Recognise a heading from two consecutive tokens
+/// @param previous The token before token
+/// @param token The current token
+/// @return The part and number of the heading that ends with token, if any
+inline auto headingOf = [](std::string_view previous, std::string_view token) -> std::optional<std::pair<Part, int>> {
+    static constexpr std::array<std::string_view, 20> cardinals = {
+        "ONE", "TWO", "THREE", "FOUR", "FIVE", "SIX", "SEVEN", "EIGHT", "NINE", "TEN", "ELEVEN", "TWELVE",
+        "THIRTEEN", "FOURTEEN", "FIFTEEN", "SIXTEEN", "SEVENTEEN", "EIGHTEEN", "NINETEEN", "TWENTY"};
+    static constexpr std::array<std::string_view, 10> ordinals = {
+        "FIRST", "SECOND", "THIRD", "FOURTH", "FIFTH", "SIXTH", "SEVENTH", "EIGHTH", "NINTH", "TENTH"};
+
+    auto numberOf = [](const auto& words, std::string_view word) {
+        const auto found = std::find(words.begin(), words.end(), word);
+        return found != words.end() ? static_cast<int>(found - words.begin()) + 1 : 0;
+    };
+
+    if (previous == "BOOK") {
+        const int number = numberOf(cardinals, token);
+        if (number > 0) return std::make_pair(Part::Book, number);
+    }
+    if (token == "EPILOGUE") {
+        const int number = numberOf(ordinals, previous);
+        if (number > 0) return std::make_pair(Part::Epilogue, number);
+    }
+    return std::nullopt;
+};
+
+/// @brief Tokens of a text together with their chapter index and headings
+struct ChapteredTokens {
+    TokenList tokens;
+    ChapterIndex chapters;
+    std::vector<Heading> headings;
+};
+
+/// @brief Tokenize a text and find its chapter boundaries and headings in the same pass
+/// @param text The text to tokenize, has to outlive the returned tokens
+/// @return The tokens (chapter markers included), the offset index of the chapters and the headings
+inline auto tokenizeChapters = [](std::string_view text) {
+    ChapteredTokens result;
+    auto& tokens = result.tokens.tokens;
+    auto& ranges = result.chapters.ranges;
+    std::string scratch;
+
+    tokens.reserve(text.size() / 6);
+    ranges.push_back({0, 0});
+    scanTokens(text, true, scratch, [&](std::string_view token, bool inText) {
+        if (isChapterMarker(token)) {
+            // Close the current chapter, the next one starts after the marker
+            ranges.back().end = tokens.size();
+            ranges.push_back({tokens.size() + 1, tokens.size() + 1});
+        } else if (!tokens.empty()) {
+            if (const auto heading = headingOf(tokens.back(), token)) {
+                result.headings.push_back({tokens.size() - 1, heading->first, heading->second});
+            }
+        }
+        tokens.push_back(inText ? token : result.tokens.arena.store(token));
+    });
+    ranges.back().end = tokens.size();
+
+    return result;
+};
+
+/// @brief Position of a section in the BOOK / CHAPTER / EPILOGUE hierarchy
+struct SectionKey {
+    Part part = Part::Front;
+    /// Number of the book or epilogue, 0 for the front matter
+    int book = 0;
+    /// Chapter number as printed in the text, restarting in every book; 0 for text before the first chapter
+    int chapter = 0;
+};
+
+/// @brief One chapter of one book
+struct Section {
+    SectionKey key;
+    /// Number of the chapter in the flat ChapterIndex
+    int flatChapter = 0;
+    /// The tokens of the chapter, without the marker and without a heading that follows it
+    TokenRange range;
+};
+
+/// @brief Hierarchical index of a book: every (part, book, chapter) maps to its token range in O(1)
+struct SectionIndex {
+    struct BookEntry {
+        /// From the first token after the heading up to the next heading
+        TokenRange range;
+        /// Index into sections per chapter number, -1 for numbers that do not occur
+        std::vector<std::int32_t> chapters;
+    };
+
+    /// All sections in text order
+    std::vector<Section> sections;
+    /// books[part][book] for every part and book number
+    std::array<std::vector<BookEntry>, partCount> books;
+
+    /// @brief Look up a section
+    /// @return The section, or nullptr if the book has no such chapter
+    const Section* find(Part part, int book, int chapter) const {
+        const auto& partBooks = books[static_cast<std::size_t>(part)];
+        if (book < 0 || static_cast<std::size_t>(book) >= partBooks.size()) return nullptr;
+        const auto& chapters = partBooks[static_cast<std::size_t>(book)].chapters;
+        if (chapter < 0 || static_cast<std::size_t>(chapter) >= chapters.size()) return nullptr;
+        const std::int32_t index = chapters[static_cast<std::size_t>(chapter)];
+        return index >= 0 ? &sections[static_cast<std::size_t>(index)] : nullptr;
+    }
+
+    /// @brief The token range of a whole book, empty if there is no such book
+    TokenRange bookRange(Part part, int book) const {
+        const auto& partBooks = books[static_cast<std::size_t>(part)];
+        return book >= 0 && static_cast<std::size_t>(book) < partBooks.size()
+            ? partBooks[static_cast<std::size_t>(book)].range : TokenRange{};
+    }
+};
+
+/// @brief Parse the number of a chapter marker ("CHAPTER_12" -> 12)
+/// Only the first maxChapterDigits digits are read, isChapterMarker accepts no longer numbers.
+inline auto chapterNumberOf = [](std::string_view marker) {
+    const std::string_view digits = marker.substr(std::string_view("CHAPTER_").size(), maxChapterDigits);
+    return std::accumulate(digits.begin(), digits.end(), 0, [](int number, char digit) { return number * 10 + (digit - '0'); });
+};
+
+/// @brief Build the hierarchical index from the flat chapters and the headings
+/// A heading inside a flat chapter ends that chapter and opens the next book; the text between
+/// the heading and the first chapter marker of the book is its chapter 0.
+/// @param chapteredTokens The result of tokenizeChapters
+/// @return The section index
+inline auto buildSectionIndex = [](const ChapteredTokens& chapteredTokens) {
+    // "BOOK ONE" and "FIRST EPILOGUE" are both two tokens long
+    constexpr std::size_t headingLength = 2;
+    const auto& tokens = chapteredTokens.tokens;
+    const auto& ranges = chapteredTokens.chapters.ranges;
+    const auto& headings = chapteredTokens.headings;
+
+    SectionIndex index;
+    SectionKey current;
+    auto nextHeading = headings.begin();
+
+    auto bookOf = [&index](const SectionKey& key) -> SectionIndex::BookEntry& {
+        auto& partBooks = index.books[static_cast<std::size_t>(key.part)];
+        if (partBooks.size() <= static_cast<std::size_t>(key.book)) {
+            partBooks.resize(static_cast<std::size_t>(key.book) + 1);
+        }
+        return partBooks[static_cast<std::size_t>(key.book)];
+    };
+
+    auto addSection = [&](int flatChapter, TokenRange range) {
+        auto& book = bookOf(current);
+        book.range.end = std::max(book.range.end, range.end);
+        if (range.empty() && current.chapter == 0) {
+            return;
+        }
+        if (book.chapters.size() <= static_cast<std::size_t>(current.chapter)) {
+            book.chapters.resize(static_cast<std::size_t>(current.chapter) + 1, -1);
+        }
+        book.chapters[static_cast<std::size_t>(current.chapter)] = static_cast<std::int32_t>(index.sections.size());
+        index.sections.push_back({current, flatChapter, range});
+    };
+
+    bookOf(current);
+    for (int flatChapter = 0; flatChapter <= chapteredTokens.chapters.lastChapter(); ++flatChapter) {
+        TokenRange range = ranges[static_cast<std::size_t>(flatChapter)];
+        current.chapter = flatChapter == 0 ? 0 : chapterNumberOf(tokens[range.begin - 1]);
+
+        while (nextHeading != headings.end() && nextHeading->position < range.end) {
+            addSection(flatChapter, {range.begin, std::max(range.begin, nextHeading->position)});
+
+            const std::size_t afterHeading = std::min(range.end, nextHeading->position + headingLength);
+            current = {nextHeading->part, nextHeading->number, 0};
+            bookOf(current).range = {afterHeading, afterHeading};
+            range = {afterHeading, range.end};
+            ++nextHeading;
+        }
+        addSection(flatChapter, range);
+    }
+
+    return index;
+};
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TEXTUAL_TIDE_X86 1
+#endif
+
+/// @brief Character classes of the tokenizer, looked up by byte instead of through the locale
+enum CharClass : unsigned char { OtherChar = 0, WordChar = 1, SeparatorChar = 2 };
+
+inline constexpr auto charClasses = [] {
+    std::array<unsigned char, 256> classes{};
+    for (int c = 'a'; c <= 'z'; ++c) classes[c] = WordChar;
+    for (int c = 'A'; c <= 'Z'; ++c) classes[c] = WordChar;
+    for (int c = '0'; c <= '9'; ++c) classes[c] = WordChar;
+    classes['_'] = WordChar;
+    for (char c : {' ', '\t', '\n', '\v', '\f', '\r'}) classes[static_cast<unsigned char>(c)] = SeparatorChar;
+    return classes;
+}();
+
+/// @brief Characters kept inside a token, everything else is stripped
+inline auto isWordChar = [](char c) {
+    return charClasses[static_cast<unsigned char>(c)] == WordChar;
+};
+
+inline auto isSeparator = [](char c) {
+    return charClasses[static_cast<unsigned char>(c)] == SeparatorChar;
+};
+
+/// @brief Classes of 64 consecutive bytes, bit i stands for byte i
+struct BlockMasks {
+    std::uint64_t word = 0;
+    std::uint64_t separator = 0;
+};
+
+/// @brief Kernel classifying the 64 bytes starting at its argument
+using BlockClassifier = BlockMasks (*)(const char*);
+
+inline BlockMasks classifyBlockScalar(const char* block) {
+    BlockMasks masks;
+    for (int i = 0; i < 64; ++i) {
+        const unsigned char charClass = charClasses[static_cast<unsigned char>(block[i])];
+        masks.word |= static_cast<std::uint64_t>(charClass == WordChar) << i;
+        masks.separator |= static_cast<std::uint64_t>(charClass == SeparatorChar) << i;
+    }
+    return masks;
+}
+
+#ifdef TEXTUAL_TIDE_X86
+// Both kernels compare bytes as unsigned ranges: shifting a byte by 0x80 - low turns
+// "low <= c < low + count" into the signed comparison "c' < -128 + count".
+
+inline __m128i inRangeSse2(__m128i bytes, char low, char count) {
+    const __m128i shifted = _mm_add_epi8(bytes, _mm_set1_epi8(static_cast<char>(0x80 - low)));
+    return _mm_cmplt_epi8(shifted, _mm_set1_epi8(static_cast<char>(-128 + count)));
+}
+
+__attribute__((target("avx2"))) inline __m256i inRangeAvx2(__m256i bytes, char low, char count) {
+    const __m256i shifted = _mm256_add_epi8(bytes, _mm256_set1_epi8(static_cast<char>(0x80 - low)));
+    return _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(-128 + count)), shifted);
+}
+
+inline BlockMasks classifyBlockSse2(const char* block) {
+    BlockMasks masks;
+    for (int i = 0; i < 4; ++i) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * i));
+        const __m128i lower = _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+        const __m128i word = _mm_or_si128(
+            _mm_or_si128(inRangeSse2(lower, 'a', 26), inRangeSse2(bytes, '0', 10)),
+            _mm_cmpeq_epi8(bytes, _mm_set1_epi8('_')));
+        const __m128i separator = _mm_or_si128(inRangeSse2(bytes, '\t', 5), _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')));
+
+        masks.word |= static_cast<std::uint64_t>(static_cast<std::uint16_t>(_mm_movemask_epi8(word))) << (16 * i);
+        masks.separator |= static_cast<std::uint64_t>(static_cast<std::uint16_t>(_mm_movemask_epi8(separator))) << (16 * i);
+    }
+    return masks;
+}
+
+__attribute__((target("avx2"))) inline BlockMasks classifyBlockAvx2(const char* block) {
+    BlockMasks masks;
+    for (int i = 0; i < 2; ++i) {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32 * i));
+        const __m256i lower = _mm256_or_si256(bytes, _mm256_set1_epi8(0x20));
+        const __m256i word = _mm256_or_si256(
+            _mm256_or_si256(inRangeAvx2(lower, 'a', 26), inRangeAvx2(bytes, '0', 10)),
+            _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('_')));
+        const __m256i separator = _mm256_or_si256(inRangeAvx2(bytes, '\t', 5), _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')));
+
+        masks.word |= static_cast<std::uint64_t>(static_cast<std::uint32_t>(_mm256_movemask_epi8(word))) << (32 * i);
+        masks.separator |= static_cast<std::uint64_t>(static_cast<std::uint32_t>(_mm256_movemask_epi8(separator))) << (32 * i);
+    }
+    return masks;
+}
+#endif
+
+/// @brief All kernels usable on this CPU, from the narrowest to the widest
+inline std::vector<std::pair<std::string_view, BlockClassifier>> availableClassifiers() {
+    std::vector<std::pair<std::string_view, BlockClassifier>> classifiers = {{"scalar", classifyBlockScalar}};
+#ifdef TEXTUAL_TIDE_X86
+    if (__builtin_cpu_supports("sse2")) {
+        classifiers.emplace_back("sse2", classifyBlockSse2);
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        classifiers.emplace_back("avx2", classifyBlockAvx2);
+    }
+#endif
+    return classifiers;
+}
+
+/// @brief The widest kernel of this CPU, detected once at startup
+/// Wider is not always faster, SSE2 can beat AVX2 on 64-byte blocks; "make bench" compares
+/// the kernels on the book.
+inline const BlockClassifier classifyBlock = availableClassifiers().back().second;
+
+/// @brief Lazily classified view of a text, one 64-byte block at a time
+/// Sequential scans classify every block exactly once (the two most recent blocks are kept, so a
+/// token crossing a block boundary is not classified twice); the last, partial block is padded
+/// with separators, so no query reports positions at or beyond the end of the text.
+class ClassifiedText {
+public:
+    ClassifiedText(std::string_view text, BlockClassifier classify) : text_(text), classify_(classify) {}
+
+    /// @brief Position of the first separator at or after position, or the text size
+    std::size_t nextSeparator(std::size_t position) { return next(position, false); }
+
+    /// @brief Position of the first non-separator at or after position, or the text size
+    std::size_t nextNonSeparator(std::size_t position) { return next(position, true); }
+
+    struct WordSpan {
+        std::size_t count = 0;
+        std::size_t first = 0;
+        std::size_t last = 0;
+    };
+
+    /// @brief Word characters in [begin, end)
+    /// @return The number of word characters and the positions of the first and last one
+    WordSpan words(std::size_t begin, std::size_t end) {
+        WordSpan span;
+        for (std::size_t block = begin / 64; block * 64 < end; ++block) {
+            const std::uint64_t mask = masksOf(block).word & rangeMask(block, begin, end);
+            if (mask == 0) {
+                continue;
+            }
+            const std::size_t first = block * 64 + static_cast<std::size_t>(__builtin_ctzll(mask));
+            span.first = span.count == 0 ? first : span.first;
+            span.last = block * 64 + 63 - static_cast<std::size_t>(__builtin_clzll(mask));
+            span.count += static_cast<std::size_t>(__builtin_popcountll(mask));
+        }
+        return span;
+    }
+
+private:
+    const BlockMasks& masksOf(std::size_t block) {
+        const std::size_t slot = block % 2;
+        if (cachedBlocks_[slot] != block) {
+            const std::size_t offset = block * 64;
+            if (offset + 64 <= text_.size()) {
+                cached_[slot] = classify_(text_.data() + offset);
+            } else {
+                std::array<char, 64> padded;
+                padded.fill(' ');
+                std::memcpy(padded.data(), text_.data() + offset, text_.size() - offset);
+                cached_[slot] = classify_(padded.data());
+            }
+            cachedBlocks_[slot] = block;
+        }
+        return cached_[slot];
+    }
+
+    static std::uint64_t rangeMask(std::size_t block, std::size_t begin, std::size_t end) {
+        const std::size_t offset = block * 64;
+        const std::uint64_t fromBegin = begin > offset ? ~0ULL << (begin - offset) : ~0ULL;
+        const std::uint64_t toEnd = end < offset + 64 ? (1ULL << (end - offset)) - 1 : ~0ULL;
+        return fromBegin & toEnd;
+    }
+
+    std::size_t next(std::size_t position, bool nonSeparator) {
+        while (position < text_.size()) {
+            const std::size_t block = position / 64;
+            const std::uint64_t separators = masksOf(block).separator;
+            const std::uint64_t candidates = (nonSeparator ? ~separators : separators) & (~0ULL << (position % 64));
+            if (candidates != 0) {
+                return std::min(text_.size(), block * 64 + static_cast<std::size_t>(__builtin_ctzll(candidates)));
+            }
+            position = (block + 1) * 64;
+        }
+        return text_.size();
+    }
+
+    std::string_view text_;
+    BlockClassifier classify_;
+    std::array<BlockMasks, 2> cached_;
+    std::array<std::size_t, 2> cachedBlocks_ = {static_cast<std::size_t>(-1), static_cast<std::size_t>(-1)};
+};
@@ -0,0 +1,291 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "textual_tide.h"
+#include "counting.h"
+#include "lexicon.h"
+#include "phrases.h"
+
+/// Pipeline combinators: stages are chained with "|" and run when a sink is attached, e.g.
+///
+///     const double share = tokens | pipes::filter(terms) | pipes::count | pipes::density;
+///
+/// A chain of stages is only a description; attaching a sink binds every stage to the next one
+/// and pushes the values of the source through all of them in a single loop. No stage builds a
+/// container, values go straight from the source to the sink. The general stages and sinks live
+/// in namespace pipes, so they do not clash with std::count, std::transform and the like.
+
+/// @brief The start of a pipeline: a range (container, Span or Generator) and the loop over it
+/// Holds a reference to an lvalue range and takes ownership of an rvalue (e.g. a generator).
+template <typename Range>
+class PipeSource {
+public:
+    using value_type = std::decay_t<decltype(*std::declval<Range&>().begin())>;
+
+    explicit PipeSource(Range&& range) : range_(std::forward<Range>(range)) {}
+
+    /// @brief Push every value into a consumer
+    /// @return The number of values read from the range
+    template <typename Consume>
+    std::size_t run(Consume&& consume) {
+        std::size_t inputs = 0;
+        for (const auto& value : range_) {
+            consume(value);
+            ++inputs;
+        }
+        return inputs;
+    }
+
+private:
+    Range range_;
+};
+
+/// @brief A pipeline: the previous pipeline followed by one more stage
+template <typename Previous, typename Stage>
+class Pipe {
+public:
+    using value_type = typename Stage::template output<typename Previous::value_type>;
+
+    Pipe(Previous previous, Stage stage) : previous_(std::move(previous)), stage_(std::move(stage)) {}
+
+    /// @brief Push every value through the stages into a consumer
+    /// @return The number of values read from the source, before any stage
+    template <typename Consume>
+    std::size_t run(Consume&& consume) {
+        return previous_.run(stage_.bind(consume));
+    }
+
+private:
+    Previous previous_;
+    Stage stage_;
+};
+
+/// @brief Marks the stage and sink types that "|" accepts
+struct PipeStage {};
+struct PipeSink {};
+
+template <typename T>
+inline constexpr bool isPipeStage = std::is_base_of_v<PipeStage, std::decay_t<T>>;
+template <typename T>
+inline constexpr bool isPipeSink = std::is_base_of_v<PipeSink, std::decay_t<T>>;
+
+template <typename T>
+struct IsPipe : std::false_type {};
+template <typename Range>
+struct IsPipe<PipeSource<Range>> : std::true_type {};
+template <typename Previous, typename Stage>
+struct IsPipe<Pipe<Previous, Stage>> : std::true_type {};
+
+/// @brief A pipeline that a sink can run, a PipeSource or a Pipe
+template <typename T>
+concept Pipeline = IsPipe<std::decay_t<T>>::value;
+
+/// @brief Add a stage to a pipeline, or start a pipeline at a range
+template <typename Input, typename Stage>
+    requires isPipeStage<Stage>
+auto operator|(Input&& input, Stage stage) {
+    if constexpr (Pipeline<Input>) {
+        return Pipe<std::decay_t<Input>, Stage>(std::forward<Input>(input), std::move(stage));
+    } else {
+        return Pipe<PipeSource<Input>, Stage>(PipeSource<Input>(std::forward<Input>(input)), std::move(stage));
+    }
+}
+
+/// @brief Run a pipeline (or a bare range) into a sink
+/// A sink may also accept the result of another sink directly, as density does with count.
+template <typename Input, typename Sink>
+    requires isPipeSink<Sink>
+auto operator|(Input&& input, const Sink& sink) {
+    if constexpr (Pipeline<Input>) {
+        auto pipe = std::forward<Input>(input);
+        return sink.drain(pipe);
+    } else if constexpr (requires { sink.drain(input); }) {
+        return sink.drain(input);
+    } else {
+        PipeSource<Input> source(std::forward<Input>(input));
+        return sink.drain(source);
+    }
+}
+
+/// @brief Stage that passes on the values a predicate accepts
+template <typename Predicate>
+struct FilterStage : PipeStage {
+    template <typename Input>
+    using output = Input;
+
+    Predicate predicate;
+
+    template <typename Next>
+    auto bind(Next& next) const {
+        return [this, &next](const auto& value) {
+            if (predicate(value)) {
+                next(value);
+            }
+        };
+    }
+};
+
+namespace pipes {
+
+/// @brief Keep the values that satisfy a condition
+/// @param condition A predicate, or a list of terms to keep (turned into a TermSet once, shared by copies)
+inline auto filter = [](auto condition) {
+    if constexpr (!requires { condition.begin(); }) {
+        return FilterStage<decltype(condition)>{{}, std::move(condition)};
+    } else {
+        auto terms = std::make_shared<const TermSet>(condition);
+        auto contains = [terms](std::string_view token) { return terms->contains(token); };
+        return FilterStage<decltype(contains)>{{}, std::move(contains)};
+    }
+};
+
+} // namespace pipes
+
+/// @brief Stage that passes on the result of a function of every value
+template <typename Function>
+struct TransformStage : PipeStage {
+    template <typename Input>
+    using output = std::decay_t<std::invoke_result_t<const Function&, const Input&>>;
+
+    Function function;
+
+    template <typename Next>
+    auto bind(Next& next) const {
+        return [this, &next](const auto& value) { next(function(value)); };
+    }
+};
+
+namespace pipes {
+
+/// @brief Replace every value by the result of a function
+inline auto transform = [](auto function) { return TransformStage<decltype(function)>{{}, std::move(function)}; };
+
+} // namespace pipes
+
+/// @brief The result of the count sink: the counts and the number of values read from the source
+/// Iterates as (value, count) pairs like countOccurences' result.
+template <typename Key>
+struct Counted {
+    FlatCountMap<Key> counts;
+    /// Values read from the source, before any filter
+    std::size_t inputs = 0;
+
+    int countOf(Key key) const { return counts.countOf(key); }
+    std::size_t size() const { return counts.size(); }
+    bool empty() const { return counts.empty(); }
+    auto begin() const { return counts.begin(); }
+    auto end() const { return counts.end(); }
+};
+
+/// @brief Sink that counts every distinct value
+struct CountSink : PipeSink {
+    template <Pipeline Source>
+    auto drain(Source& source) const {
+        Counted<CountKey<typename Source::value_type>> result;
+        auto add = [&result](const auto& value) { ++result.counts[value]; };
+        result.inputs = source.run(add);
+        return result;
+    }
+};
+
+/// @brief Sink that gives the share of the source's values that reach it
+/// After count, the share of the counted values among the values read from the source.
+struct DensitySink : PipeSink {
+    template <Pipeline Source>
+    double drain(Source& source) const {
+        std::size_t hits = 0;
+        auto add = [&hits](const auto&) { ++hits; };
+        const std::size_t inputs = source.run(add);
+        return inputs > 0 ? static_cast<double>(hits) / static_cast<double>(inputs) : 0.0;
+    }
+
+    template <typename Key>
+    double drain(const Counted<Key>& counted) const {
+        return calculateDensity(counted, static_cast<int>(counted.inputs));
+    }
+};
+
+namespace pipes {
+
+inline constexpr CountSink count{};
+inline constexpr DensitySink density{};
+
+} // namespace pipes
+
+/// @brief How hits are weighed into a density
+enum class DensityModel {
+    /// Every hit counts 1, as calculateDensity
+    Frequency,
+    /// Every hit counts 1 plus 1 / gap to the previous hit of its category, as calculateProximityDensity
+    Proximity,
+};
+
+/// @brief Sink that gives the density of every category in a sequence of term ids
+/// Single words are looked up in the category masks and phrases are followed through the
+/// automaton in the same loop. Only the hit counts are kept, and for the proximity model the
+/// position of the last hit of every category, so both models cost about as much as counting.
+/// A phrase is placed at its last token, where the automaton finds it.
+template <typename Matcher, typename Automaton>
+struct CategoryDensitySink : PipeSink {
+    const Matcher& matcher;
+    const Automaton& automaton;
+    DensityModel model;
+
+    template <Pipeline Source>
+    std::vector<double> drain(Source& source) const {
+        const std::size_t categoryCount = matcher.categoryCount();
+        std::vector<double> weights(categoryCount, 0.0);
+        // Position + 1 of the last hit of every category, 0 before the first one
+        std::vector<std::int64_t> lastHit(categoryCount, 0);
+        const bool proximity = model == DensityModel::Proximity;
+
+        std::int64_t position = 0;
+        auto hit = [&](std::size_t category) {
+            weights[category] += 1.0;
+            if (proximity) {
+                weights[category] += lastHit[category] != 0 ? proximityBonus(position + 1 - lastHit[category]) : 0.0;
+                lastHit[category] = position + 1;
+            }
+        };
+
+        std::uint32_t state = 0;
+        auto add = [&](TermId id) {
+            // Visit only the categories the token belongs to
+            for (CategoryMask mask = matcher.maskOf(id); mask != 0; mask &= mask - 1) {
+                hit(static_cast<std::size_t>(__builtin_ctzll(mask)));
+            }
+            // A phrase counts as one hit of its category
+            if (!automaton.empty()) {
+                state = automaton.next(state, id);
+                for (std::uint32_t output = automaton.outputBegin[state]; output < automaton.outputBegin[state + 1]; ++output) {
+                    hit(automaton.phrases[automaton.outputs[output]].category);
+                }
+            }
+            ++position;
+        };
+        const std::size_t inputs = source.run(add);
+
+        std::vector<double> densities(categoryCount, 0.0);
+        if (inputs > 0) {
+            std::transform(weights.begin(), weights.end(), densities.begin(),
+                           [inputs](double weight) { return weight / static_cast<double>(inputs); });
+        }
+        return densities;
+    }
+};
+
+/// @brief The densities of all categories, single words and phrases alike
+/// @param matcher The categories, anything with maskOf(id) and categoryCount() (CategoryMatcher, LexiconFile)
+/// @param automaton The phrases of the categories; both have to outlive the pipeline
+/// @param model How hits are weighed, plain counts by default
+inline auto categoryDensities = [](const auto& matcher, const auto& automaton, DensityModel model = DensityModel::Frequency) {
+    return CategoryDensitySink<std::decay_t<decltype(matcher)>, std::decay_t<decltype(automaton)>>{{}, matcher, automaton, model};
+};
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "tokenizer.h"
+#include "symbols.h"
+#include "lexicon.h"
+
+/// @brief Hash of a counting key: tokens use hashToken, term ids a multiply-xorshift mix
+inline std::uint64_t hashCountKey(std::string_view key) { return hashToken(key); }
+
+inline std::uint64_t hashCountKey(TermId key) {
+    std::uint64_t hash = (key + 1) * 0x9e3779b97f4a7c15ULL;
+    return hash ^ (hash >> 29);
+}
+
+/// @brief Open-addressing counter table for tokens (std::string_view) or term ids (TermId)
+/// Counts live in one dense array of (key, count) pairs in first-seen order; the slot array only
+/// holds a hash tag and an index into it, so probing stays within a few cache lines and
+/// iterating touches nothing but the counts. Token keys are copied once per distinct token,
+/// the table does not depend on the counted text. Iterating yields (key, count) pairs like
+/// std::unordered_map does, so the result works with calculateDensity.
+template <typename Key>
+class FlatCountMap {
+public:
+    using key_type = Key;
+    using value_type = std::pair<Key, int>;
+    using const_iterator = typename std::vector<value_type>::const_iterator;
+
+    FlatCountMap() : slots_(16) {}
+
+    /// @brief The count of a key, inserting it with count 0 on first sight
+    int& operator[](Key key) {
+        const std::uint64_t hash = hashCountKey(key);
+        const auto tag = static_cast<std::uint32_t>(hash >> 32);
+        const std::size_t mask = slots_.size() - 1;
+        for (std::size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+            const Slot candidate = slots_[slot];
+            if (candidate.entry == 0) {
+                return insert(slot, tag, key);
+            }
+            if (candidate.tag == tag && entries_[candidate.entry - 1].first == key) {
+                return entries_[candidate.entry - 1].second;
+            }
+        }
+    }
+
+    /// @brief The count of a key, 0 for keys that were never counted
+    int countOf(Key key) const {
+        const std::uint64_t hash = hashCountKey(key);
+        const auto tag = static_cast<std::uint32_t>(hash >> 32);
+        const std::size_t mask = slots_.size() - 1;
+        for (std::size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+            const Slot candidate = slots_[slot];
+            if (candidate.entry == 0) {
+                return 0;
+            }
+            if (candidate.tag == tag && entries_[candidate.entry - 1].first == key) {
+                return entries_[candidate.entry - 1].second;
+            }
+        }
+    }
+
+    /// @brief Add the counts of another table
+    /// Keys new to this table are appended in the other table's order, so merging the tables of
+    /// consecutive parts of a text gives the same table as counting the whole text at once.
+    void merge(const FlatCountMap& other) {
+        std::for_each(other.begin(), other.end(), [this](const value_type& entry) { (*this)[entry.first] += entry.second; });
+    }
+
+    /// @brief Make room for a number of distinct keys without growing in between
+    void reserve(std::size_t keyCount) {
+        entries_.reserve(keyCount);
+        if (2 * keyCount > slots_.size()) {
+            rehash(2 * keyCount);
+        }
+    }
+
+    std::size_t size() const { return entries_.size(); }
+    bool empty() const { return entries_.empty(); }
+
+    const_iterator begin() const { return entries_.begin(); }
+    const_iterator end() const { return entries_.end(); }
+
+private:
+    struct Slot {
+        std::uint32_t tag = 0;
+        /// Index + 1 into entries_, 0 marks a free slot
+        std::uint32_t entry = 0;
+    };
+
+    int& insert(std::size_t slot, std::uint32_t tag, Key key) {
+        if constexpr (std::is_same_v<Key, std::string_view>) {
+            key = key.empty() ? std::string_view("", 0) : storage_.store(key);
+        }
+        entries_.emplace_back(key, 0);
+        slots_[slot] = {tag, static_cast<std::uint32_t>(entries_.size())};
+
+        // Keep the load factor at or below one half
+        if (2 * entries_.size() > slots_.size()) {
+            rehash(2 * slots_.size());
+        }
+        return entries_.back().second;
+    }
+
+    void rehash(std::size_t minimumSlots) {
+        std::size_t capacity = slots_.size();
+        while (capacity < minimumSlots) {
+            capacity *= 2;
+        }
+        slots_.assign(capacity, Slot{});
+        const std::size_t mask = capacity - 1;
+        for (std::size_t entry = 0; entry < entries_.size(); ++entry) {
+            const std::uint64_t hash = hashCountKey(entries_[entry].first);
+            std::size_t slot = hash & mask;
+            while (slots_[slot].entry != 0) {
+                slot = (slot + 1) & mask;
+            }
+            slots_[slot] = {static_cast<std::uint32_t>(hash >> 32), static_cast<std::uint32_t>(entry + 1)};
+        }
+    }
+
+    TokenArena storage_;
+    std::vector<value_type> entries_;
+    std::vector<Slot> slots_;
+};
+
+/// @brief The counting key of a token type: std::string and std::string_view count as views, ids as ids
+template <typename Word>
+using CountKey = std::conditional_t<std::is_convertible_v<const Word&, std::string_view>, std::string_view, Word>;
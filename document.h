@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tokenizer.h"
+
+/// @brief Read-only memory mapping of a whole file
+/// Every view handed out by text(), and every token built from it, points into the
+/// mapping and must not outlive the document.
+class MappedDocument {
+public:
+    /// @brief How the mapping will be read, passed on to the kernel as a paging hint
+    enum class Access { Sequential, Random };
+
+    /// @brief Map a file into memory
+    /// @param fileName The name of the file to map
+    /// @param access Sequential for texts scanned front to back, Random for lookup tables
+    /// @return The mapped document, or std::nullopt if the file cannot be opened or mapped
+    static std::optional<MappedDocument> open(const std::string& fileName, Access access = Access::Sequential) {
+        const int fd = ::open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return std::nullopt;
+        }
+
+        struct stat info {};
+        if (::fstat(fd, &info) != 0) {
+            ::close(fd);
+            return std::nullopt;
+        }
+
+        const auto size = static_cast<std::size_t>(info.st_size);
+        if (size == 0) {
+            // mmap rejects empty mappings, an empty file is simply an empty document
+            ::close(fd);
+            return MappedDocument(nullptr, 0);
+        }
+
+        void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // The mapping keeps its own reference to the file
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            return std::nullopt;
+        }
+
+        // A book is scanned front to back exactly once, a lexicon is probed all over
+        ::madvise(data, size, access == Access::Sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+        return MappedDocument(static_cast<const char*>(data), size);
+    }
+
+    MappedDocument(const MappedDocument&) = delete;
+    MappedDocument& operator=(const MappedDocument&) = delete;
+
+    MappedDocument(MappedDocument&& other) noexcept
+        : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)) {}
+
+    MappedDocument& operator=(MappedDocument&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+        }
+        return *this;
+    }
+
+    ~MappedDocument() { unmap(); }
+
+    /// @brief The whole file content, without any copy
+    std::string_view text() const { return {data_, size_}; }
+
+    std::size_t size() const { return size_; }
+
+private:
+    MappedDocument(const char* data, std::size_t size) : data_(data), size_(size) {}
+
+    void unmap() {
+        if (data_ != nullptr) {
+            ::munmap(const_cast<char*>(data_), size_);
+        }
+    }
+
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+/// @brief Map a file into memory, the zero-copy counterpart of readFile
+/// @param fileName The name of the file to map
+/// @return The mapped document, or std::nullopt if the file cannot be read
+inline auto mapFile = [](const std::string& fileName) -> std::optional<MappedDocument> {
+    return MappedDocument::open(fileName);
+};
+
+/// @brief Splits a text that arrives in chunks into chapters
+/// A token cut by the end of a chunk is carried over into the next one, and a chapter is handed
+/// on as soon as the next chapter marker arrives, so memory is bounded by the largest chapter
+/// plus one chunk.
+class ChapterSplitter {
+public:
+    /// @brief Tokenize the next chunk of the text
+    /// @param chunk The next bytes of the text, the splitter keeps what it still needs
+    /// @param lastChunk True for the end of the text, the last chapter is handed on as well
+    /// @param onChapter Called with the chapter number and its tokens, for every non-empty chapter in order
+    template <typename OnChapter>
+    void feed(std::string_view chunk, bool lastChunk, const OnChapter& onChapter) {
+        buffer_.append(chunk);
+
+        // The last token may continue in the next chunk and stays in the buffer for the next round
+        const std::size_t consumed = scanTokens(std::string_view(buffer_), lastChunk, scratch_,
+                                                [&](std::string_view token, bool) {
+            if (isChapterMarker(token)) {
+                finishChapter(onChapter);
+                ++chapterNumber_;
+            } else {
+                // The chunk buffer is reused, the chapter keeps its own copy of the token
+                chapterTokens_.tokens.push_back(chapterTokens_.arena.store(token));
+            }
+        });
+        buffer_.erase(0, consumed);
+
+        if (lastChunk) {
+            finishChapter(onChapter);
+        }
+    }
+
+private:
+    template <typename OnChapter>
+    void finishChapter(const OnChapter& onChapter) {
+        if (!chapterTokens_.empty()) {
+            onChapter(chapterNumber_, static_cast<const TokenList&>(chapterTokens_));
+        }
+        chapterTokens_ = TokenList{};
+    }
+
+    /// Unconsumed tail of the previous chunk followed by the current chunk
+    std::string buffer_;
+    std::string scratch_;
+    int chapterNumber_ = 0;
+    TokenList chapterTokens_;
+};
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "tokenizer.h"
+
+/// @brief Lazy sequence produced by a coroutine, one value per co_yield
+/// Nothing runs until the first value is requested, and every value is produced on demand. A
+/// yielded value lives in the coroutine and is valid until the next one is requested. The
+/// sequence can be traversed once; begin() starts it and both begin() and end() return the same
+/// iterator type, so std algorithms and the range-for loop work on it.
+template <typename T>
+class Generator {
+public:
+    using value_type = std::remove_cv_t<std::remove_reference_t<T>>;
+
+    struct promise_type {
+        const value_type* current = nullptr;
+        std::exception_ptr exception;
+
+        Generator get_return_object() { return Generator(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        // A temporary yielded by value lives until the coroutine is resumed
+        std::suspend_always yield_value(const value_type& value) noexcept {
+            current = std::addressof(value);
+            return {};
+        }
+        void return_void() noexcept {}
+        void unhandled_exception() { exception = std::current_exception(); }
+    };
+
+    class iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using value_type = Generator::value_type;
+        using pointer = const value_type*;
+        using reference = const value_type&;
+
+        iterator() = default;
+        explicit iterator(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+        reference operator*() const { return *handle_.promise().current; }
+        pointer operator->() const { return handle_.promise().current; }
+
+        iterator& operator++() {
+            resume(handle_);
+            return *this;
+        }
+        void operator++(int) { ++*this; }
+
+        /// @brief Two iterators are equal when both are at the end, the only comparison an input range needs
+        bool operator==(const iterator& other) const { return done() == other.done(); }
+        bool operator!=(const iterator& other) const { return !(*this == other); }
+
+    private:
+        bool done() const { return !handle_ || handle_.done(); }
+
+        std::coroutine_handle<promise_type> handle_;
+    };
+
+    Generator(Generator&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    Generator& operator=(Generator&& other) noexcept {
+        if (this != &other) {
+            destroy();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+    Generator(const Generator&) = delete;
+    Generator& operator=(const Generator&) = delete;
+    ~Generator() { destroy(); }
+
+    /// @brief Start the sequence and point at its first value
+    iterator begin() const {
+        if (handle_) {
+            resume(handle_);
+        }
+        return iterator(handle_);
+    }
+
+    iterator end() const { return iterator(); }
+
+private:
+    explicit Generator(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+    /// @brief Run the coroutine to its next co_yield and rethrow what it threw
+    static void resume(std::coroutine_handle<promise_type> handle) {
+        handle.resume();
+        if (handle.done() && handle.promise().exception) {
+            std::rethrow_exception(handle.promise().exception);
+        }
+    }
+
+    void destroy() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+/// @brief The content of a file in fixed-size chunks
+/// @param fileName The name of the file, a file that cannot be opened yields nothing
+/// @param chunkSize The number of bytes read at once, a chunk size of 0 yields nothing
+/// @return The chunks, each valid until the next one is requested
+inline Generator<std::string_view> chunksOf(std::string fileName, std::size_t chunkSize) {
+    if (chunkSize == 0) {
+        co_return;
+    }
+    std::ifstream file(fileName, std::ios::binary);
+    std::string chunk(chunkSize, '\0');
+    while (file.is_open() && file) {
+        file.read(chunk.data(), static_cast<std::streamsize>(chunkSize));
+        co_yield std::string_view(chunk.data(), static_cast<std::size_t>(file.gcount()));
+    }
+}
+
+/// @brief Tokenize a text that arrives in chunks, one token at a time
+/// A token cut by the end of a chunk is carried over into the next one; only the tokens of one
+/// chunk are held at a time.
+/// @param chunks The chunks of the text
+/// @return The tokens, each valid until the next one is requested
+inline Generator<std::string_view> tokensOf(Generator<std::string_view> chunks) {
+    std::string buffer;
+    std::string scratch;
+    auto scan = [&buffer, &scratch](bool lastChunk, TokenList& batch) {
+        // Tokens of the buffer stay views into it, rewritten ones are copied out of the scratch space
+        return scanTokens(std::string_view(buffer), lastChunk, scratch, [&batch](std::string_view token, bool inText) {
+            batch.tokens.push_back(inText ? token : batch.arena.store(token));
+        });
+    };
+
+    for (std::string_view chunk : chunks) {
+        buffer.append(chunk);
+        TokenList batch;
+        const std::size_t consumed = scan(false, batch);
+        for (std::string_view token : batch) {
+            co_yield token;
+        }
+        buffer.erase(0, consumed);
+    }
+
+    TokenList batch;
+    scan(true, batch);
+    for (std::string_view token : batch) {
+        co_yield token;
+    }
+}
+
+/// @brief Tokenize a text lazily
+/// @param text The text, has to outlive the generator
+inline Generator<std::string_view> tokensOf(std::string_view text) {
+    auto whole = [](std::string_view all) -> Generator<std::string_view> { co_yield all; };
+    for (std::string_view token : tokensOf(whole(text))) {
+        co_yield token;
+    }
+}
+
+/// @brief A chapter of a token stream, owning its tokens
+struct ChapterTokens {
+    int number = 0;
+    TokenList tokens;
+};
+
+/// @brief Split a token stream into chapters, only the current chapter is held at a time
+/// @param tokens The tokens, "CHAPTER_<n>" markers start a new chapter
+/// @return The non-empty chapters in order, each valid until the next one is requested
+inline Generator<ChapterTokens> chaptersOf(Generator<std::string_view> tokens) {
+    ChapterTokens chapter;
+    for (std::string_view token : tokens) {
+        if (!isChapterMarker(token)) {
+            chapter.tokens.tokens.push_back(chapter.tokens.arena.store(token));
+            continue;
+        }
+        if (!chapter.tokens.empty()) {
+            co_yield chapter;
+        }
+        chapter = {chapter.number + 1, TokenList{}};
+    }
+    if (!chapter.tokens.empty()) {
+        co_yield chapter;
+    }
+}
+
+/// @brief The values of a sequence that satisfy a predicate, lazily
+/// @param values The sequence; a generator is consumed, a container is copied (pass a Span to avoid it)
+/// @param predicate The condition a value has to satisfy
+template <typename Range, typename Predicate>
+Generator<typename Range::value_type> filtered(Range values, Predicate predicate) {
+    for (const auto& value : values) {
+        if (predicate(value)) {
+            co_yield value;
+        }
+    }
+}
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <numeric>
+#include <vector>
+
+#include "symbols.h"
+#include "chapters.h"
+
+/// @brief Append a number in LEB128 form: 7 bits per byte, the high bit marks a following byte
+inline void appendVarint(std::vector<std::uint8_t>& bytes, std::uint32_t value) {
+    while (value >= 0x80) {
+        bytes.push_back(static_cast<std::uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    bytes.push_back(static_cast<std::uint8_t>(value));
+}
+
+/// @brief Read a number written by appendVarint and move past it
+inline std::uint32_t readVarint(const std::uint8_t*& cursor) {
+    std::uint32_t value = 0;
+    for (unsigned shift = 0;; shift += 7) {
+        const std::uint8_t byte = *cursor++;
+        value |= static_cast<std::uint32_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) return value;
+    }
+}
+
+/// @brief Entry point into the middle of a posting list, stored every PositionalIndex::skipInterval postings
+struct PostingSkip {
+    /// Index of the posting in its list
+    std::uint32_t index = 0;
+    /// Position of the posting
+    std::uint32_t position = 0;
+    /// Byte offset of the posting after it, relative to the start of the list
+    std::uint32_t offset = 0;
+};
+
+/// @brief Forward cursor over the positions of one term, decodes one varint per step
+/// seek() jumps over whole blocks with the skip pointers and only decodes the last one.
+class PostingCursor {
+public:
+    PostingCursor() = default;
+    PostingCursor(const std::uint8_t* bytes, std::uint32_t count, Span<PostingSkip> skips)
+        : list_(bytes), next_(bytes), count_(count), skips_(skips) {
+        advance();
+    }
+
+    bool done() const { return index_ >= count_; }
+
+    /// @brief The current position, only valid while not done
+    std::uint32_t position() const { return position_; }
+
+    /// @brief Move to the next position
+    void next() {
+        ++index_;
+        advance();
+    }
+
+    /// @brief Move to the first position at or after a target, never backwards
+    void seek(std::uint32_t target) {
+        if (done() || position_ >= target) return;
+
+        // The last skip before the target, if it lies ahead of the cursor
+        const auto skip = std::partition_point(skips_.begin(), skips_.end(),
+                                               [target](const PostingSkip& entry) { return entry.position < target; });
+        if (skip != skips_.begin() && std::prev(skip)->index > index_) {
+            index_ = std::prev(skip)->index;
+            position_ = std::prev(skip)->position;
+            next_ = list_ + std::prev(skip)->offset;
+        }
+        while (!done() && position_ < target) {
+            next();
+        }
+    }
+
+private:
+    void advance() {
+        if (done()) return;
+        // Positions are stored as gaps to the previous one, the first one as is
+        position_ = (index_ == 0 ? 0 : position_) + readVarint(next_);
+    }
+
+    const std::uint8_t* list_ = nullptr;
+    const std::uint8_t* next_ = nullptr;
+    std::uint32_t count_ = 0;
+    std::uint32_t index_ = 0;
+    std::uint32_t position_ = 0;
+    Span<PostingSkip> skips_;
+};
+
+/// @brief Positional inverted index of a token stream: term id -> ascending token positions
+/// The posting lists of all terms are stored back to back in one byte array, every position as a
+/// varint gap to the previous one, so a list costs about one byte per posting. The chapter
+/// ranges of the stream are kept with it, so positions can be mapped to chapters and a list can
+/// be read for one chapter only, without the text.
+struct PositionalIndex {
+    static constexpr std::uint32_t skipInterval = 64;
+
+    /// Start of the posting list of every term in bytes, one more entry than terms
+    std::vector<std::uint64_t> listBegin;
+    /// Number of postings of every term
+    std::vector<std::uint32_t> counts;
+    /// Skips of term t are skips[skipBegin[t], skipBegin[t + 1])
+    std::vector<std::uint32_t> skipBegin;
+    std::vector<PostingSkip> skips;
+    std::vector<std::uint8_t> bytes;
+    ChapterIndex chapters;
+    std::size_t tokenCount = 0;
+
+    std::size_t termCount() const { return counts.size(); }
+
+    /// @brief The number of occurences of a term, 0 for unknown ids
+    std::uint32_t count(TermId term) const { return term < counts.size() ? counts[term] : 0; }
+
+    /// @brief A cursor at the first position of a term
+    PostingCursor postings(TermId term) const {
+        if (term >= counts.size()) return {};
+        return PostingCursor(bytes.data() + listBegin[term], counts[term], spanOf(skips, {skipBegin[term], skipBegin[term + 1]}));
+    }
+
+    /// @brief The positions of a term within a range of the stream, decoded
+    std::vector<std::uint32_t> positions(TermId term, TokenRange range) const {
+        std::vector<std::uint32_t> result;
+        PostingCursor cursor = postings(term);
+        for (cursor.seek(static_cast<std::uint32_t>(range.begin)); !cursor.done() && cursor.position() < range.end; cursor.next()) {
+            result.push_back(cursor.position());
+        }
+        return result;
+    }
+
+    /// @brief All positions of a term, decoded
+    std::vector<std::uint32_t> positions(TermId term) const { return positions(term, {0, tokenCount}); }
+
+    /// @brief The number of occurences of a term within a range of the stream
+    std::size_t countIn(TermId term, TokenRange range) const { return positions(term, range).size(); }
+
+    /// @brief The chapter a position belongs to, -1 for chapter markers
+    int chapterOf(std::uint32_t position) const {
+        const auto& ranges = chapters.ranges;
+        const auto after = std::partition_point(ranges.begin(), ranges.end(),
+                                                [position](const TokenRange& range) { return range.begin <= position; });
+        const auto chapter = after - ranges.begin() - 1;
+        return chapter >= 0 && position < ranges[static_cast<std::size_t>(chapter)].end ? static_cast<int>(chapter) : -1;
+    }
+
+    /// @brief The number of occurences of a term in every chapter, one pass over its posting list
+    std::vector<std::uint32_t> chapterCounts(TermId term) const {
+        std::vector<std::uint32_t> result(chapters.ranges.size(), 0);
+        std::size_t chapter = 0;
+        for (PostingCursor cursor = postings(term); !cursor.done(); cursor.next()) {
+            // Postings and chapters are both in stream order
+            while (chapter < result.size() && chapters.ranges[chapter].end <= cursor.position()) {
+                ++chapter;
+            }
+            if (chapter < result.size() && chapters.ranges[chapter].begin <= cursor.position()) {
+                ++result[chapter];
+            }
+        }
+        return result;
+    }
+};
+
+/// @brief Build the positional index of an interned token stream
+/// Positions are bucketed by term with a counting sort, so they come out ascending, and then
+/// encoded list by list.
+/// @param ids The interned tokens, a vector or a Span of ids
+/// @param chapters The chapter ranges of the same stream
+/// @return The index
+inline auto buildPositionalIndex = [](const auto& ids, const ChapterIndex& chapters) {
+    PositionalIndex index;
+    index.chapters = chapters;
+    index.tokenCount = ids.size();
+
+    const TermId termCount = ids.empty() ? 0 : *std::max_element(ids.begin(), ids.end()) + 1;
+    index.counts.assign(termCount, 0);
+    std::for_each(ids.begin(), ids.end(), [&index](TermId id) { ++index.counts[id]; });
+
+    // Counting sort of the positions by term
+    std::vector<std::size_t> bucketBegin(termCount + 1, 0);
+    std::partial_sum(index.counts.begin(), index.counts.end(), std::next(bucketBegin.begin()));
+    std::vector<std::uint32_t> sorted(ids.size());
+    std::vector<std::size_t> fill(bucketBegin.begin(), std::prev(bucketBegin.end()));
+    std::uint32_t position = 0;
+    std::for_each(ids.begin(), ids.end(), [&](TermId id) { sorted[fill[id]++] = position++; });
+
+    // Encode every list as gaps, with a skip after every skipInterval postings
+    index.bytes.reserve(ids.size() + ids.size() / 4);
+    index.listBegin.reserve(termCount + 1);
+    index.skipBegin.reserve(termCount + 1);
+    for (TermId term = 0; term < termCount; ++term) {
+        const std::size_t listStart = index.bytes.size();
+        index.listBegin.push_back(listStart);
+        index.skipBegin.push_back(static_cast<std::uint32_t>(index.skips.size()));
+        std::uint32_t previous = 0;
+        for (std::size_t posting = bucketBegin[term]; posting < bucketBegin[term + 1]; ++posting) {
+            appendVarint(index.bytes, sorted[posting] - previous);
+            previous = sorted[posting];
+            const auto postingIndex = static_cast<std::uint32_t>(posting - bucketBegin[term]);
+            if ((postingIndex + 1) % PositionalIndex::skipInterval == 0 && posting + 1 < bucketBegin[term + 1]) {
+                index.skips.push_back({postingIndex, previous, static_cast<std::uint32_t>(index.bytes.size() - listStart)});
+            }
+        }
+    }
+    index.listBegin.push_back(index.bytes.size());
+    index.skipBegin.push_back(static_cast<std::uint32_t>(index.skips.size()));
+
+    return index;
+};
+
+/// @brief The positions of any of several terms (e.g. the words of a category) within a range
+/// @param index The index
+/// @param terms The term ids
+/// @param range The part of the stream, e.g. a chapter
+/// @return The positions in ascending order, the lists of the terms merged
+inline auto mergedPositions = [](const PositionalIndex& index, const auto& terms, TokenRange range) {
+    // One k-way merge: a min-heap of the cursors on their current position, so every position
+    // costs one heap step of log(k) instead of re-merging everything found so far per term
+    const auto inRange = [&range](const PostingCursor& cursor) { return !cursor.done() && cursor.position() < range.end; };
+    const auto later = [](const PostingCursor& a, const PostingCursor& b) { return a.position() > b.position(); };
+    std::vector<PostingCursor> cursors;
+    std::for_each(terms.begin(), terms.end(), [&](TermId term) {
+        PostingCursor cursor = index.postings(term);
+        cursor.seek(static_cast<std::uint32_t>(range.begin));
+        if (inRange(cursor)) cursors.push_back(cursor);
+    });
+    std::make_heap(cursors.begin(), cursors.end(), later);
+
+    std::vector<std::uint32_t> result;
+    while (!cursors.empty()) {
+        std::pop_heap(cursors.begin(), cursors.end(), later);
+        PostingCursor& cursor = cursors.back();
+        result.push_back(cursor.position());
+        cursor.next();
+        if (inRange(cursor)) {
+            std::push_heap(cursors.begin(), cursors.end(), later);
+        } else {
+            cursors.pop_back();
+        }
+    }
+    return result;
+};
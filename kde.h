@@ -0,0 +1,223 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <numeric>
+#include <vector>
+
+#include "profile.h"
+
+/// @brief Product of two complex numbers
+/// Written out because std::complex's operator* takes a slow library path for infinities and
+/// NaNs, which the hit streams never contain.
+inline std::complex<double> multiplyComplex(std::complex<double> a, std::complex<double> b) {
+    return {a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real()};
+}
+
+/// @brief Radix-2 fast Fourier transform of one size
+/// Iterative Cooley-Tukey: the values are put in bit-reversed order, then combined in log2(n)
+/// rounds of butterflies. The bit-reversal permutation and the n / 2 twiddle factors are
+/// computed once per size; every twiddle is computed directly, so the rounding error does not
+/// build up over the rounds.
+class FourierTransform {
+public:
+    /// @param size The number of values, a power of two
+    explicit FourierTransform(std::size_t size) : twiddles_(size / 2), reversed_(size, 0) {
+        const double pi = std::acos(-1.0);
+        for (std::size_t k = 0; k < twiddles_.size(); ++k) {
+            twiddles_[k] = std::polar(1.0, -2.0 * pi * static_cast<double>(k) / static_cast<double>(size));
+        }
+        for (std::size_t index = 1; index < size; ++index) {
+            reversed_[index] = (reversed_[index >> 1] >> 1) | ((index & 1) != 0 ? size >> 1 : 0);
+        }
+    }
+
+    std::size_t size() const { return reversed_.size(); }
+
+    /// @brief Replace the values by their transform
+    void forward(std::vector<std::complex<double>>& values) const { transform(values, false); }
+
+    /// @brief Replace a transform by its values; forward and inverse give back the input
+    void inverse(std::vector<std::complex<double>>& values) const {
+        transform(values, true);
+        const double scale = 1.0 / static_cast<double>(size());
+        std::for_each(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(size()),
+                      [scale](std::complex<double>& value) { value *= scale; });
+    }
+
+private:
+    void transform(std::vector<std::complex<double>>& values, bool inverse) const {
+        const std::size_t count = size();
+        for (std::size_t index = 0; index < count; ++index) {
+            if (index < reversed_[index]) {
+                std::swap(values[index], values[reversed_[index]]);
+            }
+        }
+        for (std::size_t length = 2; length <= count; length *= 2) {
+            const std::size_t half = length / 2;
+            const std::size_t step = count / length;
+            for (std::size_t block = 0; block < count; block += length) {
+                for (std::size_t k = 0; k < half; ++k) {
+                    const std::complex<double> twiddle = inverse ? std::conj(twiddles_[k * step]) : twiddles_[k * step];
+                    const std::complex<double> odd = multiplyComplex(values[block + k + half], twiddle);
+                    values[block + k + half] = values[block + k] - odd;
+                    values[block + k] += odd;
+                }
+            }
+        }
+    }
+
+    std::vector<std::complex<double>> twiddles_;
+    std::vector<std::size_t> reversed_;
+};
+
+/// @brief In-place fast Fourier transform
+/// @param values The signal, its size has to be a power of two; replaced by its transform
+/// @param inverse Transform back; the result is scaled by 1 / n, so a round trip gives the signal
+inline void fft(std::vector<std::complex<double>>& values, bool inverse) {
+    const FourierTransform transform(values.size());
+    inverse ? transform.inverse(values) : transform.forward(values);
+}
+
+/// @brief Shape of a smoothing kernel
+enum class KernelShape {
+    /// exp(-x^2 / (2 width^2)), cut at 4 widths
+    Gaussian,
+    /// exp(-|x| / width), cut at 8 widths
+    Exponential,
+};
+
+/// @brief A symmetric smoothing kernel sampled at whole tokens
+/// A kernel reaching further than the sequence it smooths adds nothing but cost, so the radius
+/// is capped: a very wide kernel is cut off at the ends of the sequence.
+/// @param shape The shape
+/// @param width The standard deviation (Gaussian) or decay length (exponential) in tokens, finite and > 0
+/// @param maxRadius The largest radius, e.g. the number of tokens to smooth; 2^24 tokens by default
+/// @return 2 * radius + 1 weights that add up to 1, the center at index radius
+inline auto smoothingKernel = [](KernelShape shape, double width, std::size_t maxRadius = std::size_t{1} << 24) {
+    const double cutoff = shape == KernelShape::Gaussian ? 4.0 : 8.0;
+    // Capped in floating point, so a huge width never overflows the conversion
+    const auto radius = static_cast<std::size_t>(std::min(std::ceil(cutoff * width), static_cast<double>(maxRadius)));
+    std::vector<double> kernel(2 * radius + 1);
+    for (std::size_t index = 0; index < kernel.size(); ++index) {
+        const double x = static_cast<double>(index) - static_cast<double>(radius);
+        kernel[index] = shape == KernelShape::Gaussian ? std::exp(-x * x / (2.0 * width * width)) : std::exp(-std::abs(x) / width);
+    }
+    const double total = std::accumulate(kernel.begin(), kernel.end(), 0.0);
+    std::for_each(kernel.begin(), kernel.end(), [total](double& weight) { weight /= total; });
+    return kernel;
+};
+
+/// @brief Kernel-smoothed hit densities of every category over a token sequence
+/// The hit stream of every category (1 per hit at its token) is convolved with the kernel by
+/// FFT, in blocks (overlap-add): every block of the stream is transformed, multiplied with the
+/// kernel's transform and transformed back, and the blocks' results are added up. A block
+/// holds at least twice the kernel, so the cost is O(n log w) <= O(n log n) for a kernel of w
+/// tokens, and the transforms stay in cache. Two categories share one complex transform, one
+/// as the real and one as the imaginary part; the kernel is real, so they do not mix. Near the
+/// ends the result is divided by the part of the kernel inside the sequence, so the curves are
+/// not pulled towards 0 there.
+/// @param sums The running hit counts of the sequence
+/// @param kernel The kernel from smoothingKernel
+/// @return densities[c][i], the smoothed share of hits of category c around token i
+inline auto kernelDensities = [](const HitPrefixSums& sums, const std::vector<double>& kernel) {
+    const std::size_t tokenCount = sums.tokenCount();
+    const std::size_t radius = kernel.size() / 2;
+    std::vector<std::vector<double>> densities(sums.categoryCount(), std::vector<double>(tokenCount, 0.0));
+    if (tokenCount == 0) {
+        return densities;
+    }
+
+    // Every block of the stream plus the kernel fits a transform without wrapping around
+    constexpr std::size_t minimumBlockSize = 4096;
+    std::size_t size = minimumBlockSize;
+    while (size < 2 * kernel.size()) {
+        size *= 2;
+    }
+    const std::size_t blockLength = size - kernel.size() + 1;
+    const FourierTransform transform(size);
+    std::vector<std::complex<double>> kernelTransform(size);
+    std::copy(kernel.begin(), kernel.end(), kernelTransform.begin());
+    transform.forward(kernelTransform);
+
+    // Kernel mass inside the sequence for every token, from the running sum of the kernel
+    std::vector<double> kernelMass(kernel.size() + 1, 0.0);
+    std::partial_sum(kernel.begin(), kernel.end(), std::next(kernelMass.begin()));
+    std::vector<double> coverage(tokenCount);
+    for (std::size_t token = 0; token < tokenCount; ++token) {
+        // Kernel index j weighs the hit at token + radius - j
+        const std::size_t first = token + radius + 1 > tokenCount ? token + radius + 1 - tokenCount : 0;
+        const std::size_t last = std::min(kernel.size(), token + radius + 1);
+        coverage[token] = kernelMass[last] - kernelMass[first];
+    }
+
+    std::vector<std::complex<double>> block(size);
+    std::vector<std::complex<double>> convolved(tokenCount + kernel.size() - 1);
+    for (std::size_t category = 0; category < sums.categoryCount(); category += 2) {
+        const bool paired = category + 1 < sums.categoryCount();
+        std::fill(convolved.begin(), convolved.end(), std::complex<double>());
+        for (std::size_t blockStart = 0; blockStart < tokenCount; blockStart += blockLength) {
+            const std::size_t blockEnd = std::min(blockStart + blockLength, tokenCount);
+            std::fill(block.begin(), block.end(), std::complex<double>());
+            for (std::size_t token = blockStart; token < blockEnd; ++token) {
+                const TokenRange at = {token, token + 1};
+                block[token - blockStart] = {static_cast<double>(sums.hitsIn(category, at)),
+                                             paired ? static_cast<double>(sums.hitsIn(category + 1, at)) : 0.0};
+            }
+
+            transform.forward(block);
+            std::transform(block.begin(), block.end(), kernelTransform.begin(), block.begin(), multiplyComplex);
+            transform.inverse(block);
+
+            // The block's result reaches kernel.size() - 1 tokens into the next block
+            const std::size_t resultLength = std::min(blockEnd - blockStart + kernel.size() - 1, convolved.size() - blockStart);
+            std::transform(block.begin(), block.begin() + static_cast<std::ptrdiff_t>(resultLength),
+                           convolved.begin() + static_cast<std::ptrdiff_t>(blockStart),
+                           convolved.begin() + static_cast<std::ptrdiff_t>(blockStart), std::plus<>());
+        }
+
+        // The kernel's center lands radius tokens after the hit
+        for (std::size_t token = 0; token < tokenCount; ++token) {
+            const std::complex<double> smoothed = convolved[token + radius] / coverage[token];
+            densities[category][token] = std::max(smoothed.real(), 0.0);
+            if (paired) {
+                densities[category + 1][token] = std::max(smoothed.imag(), 0.0);
+            }
+        }
+    }
+    return densities;
+};
+
+/// @brief A point where the dominant category of two curves changes
+struct Transition {
+    std::size_t position = 0;
+    /// True if the first curve takes over, false if the second one does
+    bool toFirst = false;
+};
+
+/// @brief The points where one curve overtakes the other
+/// Differences within rounding noise are ties, and a tie does not change the lead: it only
+/// changes where the other curve is clearly ahead.
+/// @param first The first curve, e.g. the smoothed war density
+/// @param second The second curve, same length
+/// @param range The part of the curves to look at
+/// @return The changes of the lead in order; the first entry is where a curve leads first
+inline auto findTransitions = [](const std::vector<double>& first, const std::vector<double>& second, TokenRange range) {
+    constexpr double tolerance = 1e-9;
+    std::vector<Transition> transitions;
+    int leader = 0; // 1: first ahead, -1: second ahead, 0: not decided yet
+    for (std::size_t token = range.begin; token < range.end; ++token) {
+        const double difference = first[token] - second[token];
+        const int ahead = difference > tolerance ? 1 : difference < -tolerance ? -1 : 0;
+        if (ahead != 0 && ahead != leader) {
+            transitions.push_back({token, ahead == 1});
+            leader = ahead;
+        }
+    }
+    return transitions;
+};
@@ -0,0 +1,40 @@
+#include "document.h"
+#include "lexicon_file.h"
+
+#include <iostream>
+
+/// @brief Compiles word lists into a lexicon file for "TextualTide --lexicon"
+/// Usage: TextualTideLexc -o <output.ttlex> <name>=<file> [<name>=<file> ...], one category per list
+int main(int argc, char* argv[]) {
+    const std::vector<std::string> arguments(argv + 1, argv + argc);
+    const auto output = std::find(arguments.begin(), arguments.end(), "-o");
+    if (output == arguments.end() || std::next(output) == arguments.end()) {
+        std::cerr << "Usage: TextualTideLexc -o <output.ttlex> <name>=<file> [<name>=<file> ...]" << std::endl;
+        return 1;
+    }
+
+    // The lists stay mapped until the lexicon is compiled
+    std::vector<MappedDocument> documents;
+    std::vector<std::pair<std::string, std::string_view>> lists;
+    for (auto argument = arguments.begin(); argument != arguments.end(); ++argument) {
+        if (argument == output || argument == std::next(output)) continue;
+        const auto separator = argument->find('=');
+        auto document = separator != std::string::npos ? mapFile(argument->substr(separator + 1)) : std::nullopt;
+        if (!document) {
+            std::cerr << "Cannot load category " << *argument << std::endl;
+            return 1;
+        }
+        documents.push_back(std::move(*document));
+        lists.emplace_back(argument->substr(0, separator), documents.back().text());
+    }
+    if (lists.size() > maxCategories) {
+        std::cerr << "A lexicon supports at most " << maxCategories << " categories" << std::endl;
+        return 1;
+    }
+
+    if (!writeLexiconFile(*std::next(output), compileLexicon(lists))) {
+        std::cerr << "Cannot write " << *std::next(output) << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include "document.h"
+#include "phrases.h"
+
+#include <iostream>
+
+/// @brief Generates builtin_terms.h: the word lists given as "<name>=<file>" become constexpr
+/// arrays of their words and phrases, so TextualTide neither reads nor tokenizes them at startup.
+int main(int argc, char* argv[]) {
+    std::vector<std::string> names;
+    std::vector<std::pair<std::size_t, std::string>> terms;
+    std::vector<std::pair<std::size_t, std::vector<std::string>>> phrases;
+
+    for (int argument = 1; argument < argc; ++argument) {
+        const std::string definition = argv[argument];
+        const auto separator = definition.find('=');
+        const auto document = separator != std::string::npos ? mapFile(definition.substr(separator + 1)) : std::nullopt;
+        if (!document || names.size() == maxCategories) {
+            std::cerr << "Cannot load category " << definition << std::endl;
+            return 1;
+        }
+
+        const std::size_t category = names.size();
+        names.push_back(definition.substr(0, separator));
+        const auto entries = readLexiconEntries(document->text());
+        std::for_each(entries.begin(), entries.end(), [&](const std::vector<std::string>& entry) {
+            if (entry.size() == 1) {
+                terms.emplace_back(category, entry.front());
+                return;
+            }
+            phrases.emplace_back(category, entry);
+        });
+    }
+
+    // Tokens consist of word characters only, none of them needs escaping in a string literal
+    std::ostream& out = std::cout;
+    out << "// Generated by TextualTideLexgen, do not edit\n"
+        << "#pragma once\n\n"
+        << "#include <array>\n\n"
+        << "#include \"lexicon.h\"\n\n";
+
+    out << "inline constexpr std::array<std::string_view, " << names.size() << "> builtinCategoryNames = {";
+    for (std::size_t category = 0; category < names.size(); ++category) {
+        out << (category == 0 ? "" : ", ") << '"' << names[category] << '"';
+    }
+    out << "};\n\n";
+
+    // Entries are (category, text) pairs in the order of the files
+    auto writeEntries = [&out](const std::string& name, const std::vector<std::pair<std::size_t, std::string>>& entries) {
+        out << "inline constexpr std::array<StaticLexiconEntry, " << entries.size() << "> " << name << " = {{";
+        for (std::size_t entry = 0; entry < entries.size(); ++entry) {
+            out << (entry == 0 ? "" : ", ") << "{" << entries[entry].first << ", \"" << entries[entry].second << "\"}";
+        }
+        out << "}};\n";
+    };
+    writeEntries("builtinTerms", terms);
+    out << "\n";
+
+    // Phrases are written split into their words, so startup does not tokenize them either
+    std::size_t wordCount = 0;
+    std::for_each(phrases.begin(), phrases.end(), [&wordCount](const auto& phrase) { wordCount += phrase.second.size(); });
+    out << "inline constexpr std::array<std::string_view, " << wordCount << "> builtinPhraseWords = {";
+    std::size_t first = 0;
+    std::for_each(phrases.begin(), phrases.end(), [&](const auto& phrase) {
+        std::for_each(phrase.second.begin(), phrase.second.end(), [&](const std::string& word) {
+            out << (first++ == 0 ? "" : ", ") << '"' << word << '"';
+        });
+    });
+    out << "};\n\n";
+
+    out << "inline constexpr std::array<StaticPhrase, " << phrases.size() << "> builtinPhrases = {{";
+    first = 0;
+    for (std::size_t phrase = 0; phrase < phrases.size(); ++phrase) {
+        const std::size_t length = phrases[phrase].second.size();
+        out << (phrase == 0 ? "" : ", ") << "{" << phrases[phrase].first << ", " << first << ", " << length << "}";
+        first += length;
+    }
+    out << "}};\n";
+
+    return out ? 0 : 1;
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "tokenizer.h"
+#include "symbols.h"
+
+/// @brief FNV-1a hash of a token, usable at compile time
+/// @param token The token to hash
+/// @param seed Mixed into the offset basis, lets callers derive independent hash functions
+/// @return The 64 bit hash
+inline constexpr std::uint64_t hashToken(std::string_view token, std::uint64_t seed = 0) {
+    std::uint64_t hash = 0xcbf29ce484222325ULL ^ (seed * 0x9e3779b97f4a7c15ULL);
+    for (char c : token) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001b3ULL;
+    }
+    // FNV leaves the low bits weak for short keys, finish with a multiply-xorshift
+    hash ^= hash >> 32;
+    hash *= 0xd6e8feb86659fd93ULL;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/// @brief A single-word entry of a built-in lexicon (builtin_terms.h)
+struct StaticLexiconEntry {
+    std::size_t category;
+    std::string_view text;
+};
+
+/// @brief A phrase of a built-in lexicon, already split: its words are [first, first + length)
+/// of the lexicon's word array (builtinPhraseWords)
+struct StaticPhrase {
+    std::size_t category;
+    std::size_t first;
+    std::size_t length;
+};
+
+/// @brief Immutable open-addressing hash set of terms
+/// Built once from a term list; a lookup hashes the token once and probes a flat array,
+/// independent of the number of terms. The set owns copies of its terms.
+class TermSet {
+public:
+    TermSet() = default;
+
+    /// @brief Build the set from a term list
+    /// @param termList The terms (std::string or std::string_view), duplicates are ignored
+    template <typename TermList>
+    explicit TermSet(const TermList& termList) {
+        // Keep the load factor at or below one half, probe sequences stay short
+        std::size_t capacity = 8;
+        while (capacity < 2 * static_cast<std::size_t>(std::distance(termList.begin(), termList.end()))) {
+            capacity *= 2;
+        }
+        slots_.resize(capacity);
+        mask_ = capacity - 1;
+
+        std::for_each(termList.begin(), termList.end(), [this](std::string_view term) { insert(term); });
+    }
+
+    /// @brief Check if a token is one of the terms
+    bool contains(std::string_view token) const {
+        if (slots_.empty()) {
+            return false;
+        }
+        const std::uint64_t hash = hashToken(token);
+        for (std::size_t slot = hash & mask_;; slot = (slot + 1) & mask_) {
+            const Slot& candidate = slots_[slot];
+            if (candidate.term.data() == nullptr) {
+                return false;
+            }
+            if (candidate.hash == hash && candidate.term == token) {
+                return true;
+            }
+        }
+    }
+
+    /// @brief The number of distinct terms
+    std::size_t size() const { return size_; }
+
+private:
+    struct Slot {
+        std::uint64_t hash = 0;
+        std::string_view term;
+    };
+
+    void insert(std::string_view term) {
+        const std::uint64_t hash = hashToken(term);
+        std::size_t slot = hash & mask_;
+        for (; slots_[slot].term.data() != nullptr; slot = (slot + 1) & mask_) {
+            if (slots_[slot].hash == hash && slots_[slot].term == term) {
+                return;
+            }
+        }
+        // An empty term still needs a non-null view to mark its slot as used
+        slots_[slot] = {hash, term.empty() ? std::string_view("", 0) : storage_.store(term)};
+        ++size_;
+    }
+
+    TokenArena storage_;
+    std::vector<Slot> slots_;
+    std::size_t mask_ = 0;
+    std::size_t size_ = 0;
+};
+
+/// @brief Set of categories a term belongs to, bit c stands for category c
+using CategoryMask = std::uint64_t;
+
+inline constexpr std::size_t maxCategories = 64;
+
+/// @brief Labels interned tokens against any number of lexicons at once
+/// Every term id maps to the mask of the categories it belongs to, so a single array lookup
+/// per token classifies it against all lexicons.
+class CategoryMatcher {
+public:
+    /// @brief Add a lexicon as a new category
+    /// @param symbols The table the text is interned into
+    /// @param name The name of the category
+    /// @param termList The terms of the category
+    /// @return The index of the category
+    template <typename TermList>
+    std::size_t addCategory(SymbolTable& symbols, std::string name, const TermList& termList) {
+        const std::size_t category = names_.size();
+        if (category == maxCategories) {
+            throw std::length_error("CategoryMatcher supports at most 64 categories");
+        }
+        names_.push_back(std::move(name));
+        std::for_each(termList.begin(), termList.end(), [&](std::string_view term) {
+            const TermId id = symbols.intern(term);
+            if (id >= masks_.size()) {
+                masks_.resize(id + 1, 0);
+            }
+            masks_[id] |= CategoryMask{1} << category;
+        });
+        return category;
+    }
+
+    /// @brief The categories of a term id, 0 for ids that are in no lexicon
+    CategoryMask maskOf(TermId id) const { return id < masks_.size() ? masks_[id] : 0; }
+
+    std::size_t categoryCount() const { return names_.size(); }
+
+    const std::string& name(std::size_t category) const { return names_[category]; }
+
+private:
+    std::vector<std::string> names_;
+    std::vector<CategoryMask> masks_;
+};
+
+/// @brief Hits of all categories in one token sequence
+struct CategoryHits {
+    /// Number of hits per category
+    std::vector<int> counts;
+    /// Positions of the hits per category, relative to the start of the sequence, ascending
+    std::vector<std::vector<std::uint32_t>> positions;
+};
+
+/// @brief Label every token against all categories in a single pass
+/// @param matcher The categories, anything with maskOf(id) and categoryCount() (CategoryMatcher, LexiconFile)
+/// @param ids The interned tokens, a vector or a Span of ids
+/// @return Counts and positions of the hits of every category
+inline auto matchCategories = [](const auto& matcher, const auto& ids) {
+    CategoryHits hits;
+    hits.counts.resize(matcher.categoryCount(), 0);
+    hits.positions.resize(matcher.categoryCount());
+
+    std::uint32_t position = 0;
+    std::for_each(ids.begin(), ids.end(), [&](TermId id) {
+        // Visit only the categories the token belongs to
+        for (CategoryMask mask = matcher.maskOf(id); mask != 0; mask &= mask - 1) {
+            const auto category = static_cast<std::size_t>(__builtin_ctzll(mask));
+            ++hits.counts[category];
+            hits.positions[category].push_back(position);
+        }
+        ++position;
+    });
+
+    return hits;
+};
+
+/// @brief Density of one category, the share of tokens that are hits
+/// @param hits The hits of a token sequence
+/// @param category The category
+/// @param totalWords The length of the token sequence
+/// @return The density, 0 for an empty sequence
+inline auto categoryDensity = [](const CategoryHits& hits, std::size_t category, std::size_t totalWords) {
+    return totalWords > 0 ? static_cast<double>(hits.counts[category]) / static_cast<double>(totalWords) : 0.0;
+};
@@ -0,0 +1,325 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "document.h"
+#include "symbols.h"
+#include "chapters.h"
+#include "lexicon.h"
+#include "phrases.h"
+#include "perfect_hash.h"
+
+/// @brief First bytes of every compiled lexicon (.ttlex)
+inline constexpr std::array<char, 8> lexiconFileMagic = {'T', 'T', 'L', 'E', 'X', '\0', '\r', '\n'};
+
+/// @brief Format version; also rejects files written on a host of the other byte order
+inline constexpr std::uint32_t lexiconFileVersion = 1;
+
+/// @brief Header of a compiled lexicon
+/// The header is followed by these arrays, in host byte order, each starting at a multiple of
+/// 8 bytes: displacements[bucketCount], slotWords[slotCount], wordMasks[wordCount],
+/// wordOffsets[wordCount + 1], nameOffsets[categoryCount + 1], edgeBegin[stateCount + 1],
+/// edgeSymbols[edgeCount], edgeTargets[edgeCount], fail[stateCount], outputBegin[stateCount + 1],
+/// outputs[outputCount], rootNext[rootNextCount], phrases[phraseCount], strings[stringBytes].
+struct LexiconFileHeader {
+    std::array<char, 8> magic = lexiconFileMagic;
+    std::uint32_t version = lexiconFileVersion;
+    std::uint32_t categoryCount = 0;
+    std::uint32_t wordCount = 0;
+    std::uint32_t bucketCount = 0;
+    std::uint32_t slotCount = 0;
+    std::uint32_t stateCount = 0;
+    std::uint32_t edgeCount = 0;
+    std::uint32_t outputCount = 0;
+    std::uint32_t rootNextCount = 0;
+    std::uint32_t phraseCount = 0;
+    std::uint32_t stringBytes = 0;
+    std::uint32_t reserved = 0;
+};
+
+static_assert(sizeof(LexiconFileHeader) == 56, "the header is part of the file format");
+
+/// @brief Term lists compiled into lexicon-local ids, the content of a lexicon file
+struct CompiledLexicon {
+    std::vector<std::string> names;
+    /// Every word of the lexicon, single terms and phrase words; the ids are the local ids
+    SymbolTable words;
+    /// Categories of every word as a single term
+    std::vector<CategoryMask> masks;
+    PhraseAutomaton phrases;
+};
+
+/// @brief Compile word lists, one category per list
+/// @param lists Pairs of (category name, content of the word list)
+/// @return The compiled lexicon
+inline auto compileLexicon = [](const std::vector<std::pair<std::string, std::string_view>>& lists) {
+    if (lists.size() > maxCategories) {
+        throw std::length_error("a lexicon supports at most 64 categories");
+    }
+
+    CompiledLexicon lexicon;
+    std::vector<PhraseEntry> phraseEntries;
+    for (std::size_t category = 0; category < lists.size(); ++category) {
+        lexicon.names.push_back(lists[category].first);
+        const auto entries = readLexiconEntries(lists[category].second);
+        std::for_each(entries.begin(), entries.end(), [&](const std::vector<std::string>& entry) {
+            if (entry.size() > 1) {
+                phraseEntries.push_back({entry, category});
+                return;
+            }
+            const TermId id = lexicon.words.intern(entry.front());
+            lexicon.masks.resize(std::max<std::size_t>(lexicon.masks.size(), id + 1), 0);
+            lexicon.masks[id] |= CategoryMask{1} << category;
+        });
+    }
+    lexicon.phrases = buildPhraseAutomaton(lexicon.words, phraseEntries);
+    lexicon.masks.resize(lexicon.words.size(), 0);
+
+    return lexicon;
+};
+
+/// @brief Write a compiled lexicon to a file
+/// @param fileName The name of the file
+/// @param lexicon The lexicon
+/// @return true if the file was written completely
+inline auto writeLexiconFile = [](const std::string& fileName, const CompiledLexicon& lexicon) {
+    std::vector<std::string> keys;
+    for (TermId id = 0; id < lexicon.words.size(); ++id) {
+        keys.emplace_back(lexicon.words.name(id));
+    }
+    const auto layout = buildPerfectHash(keys);
+
+    // Words and category names share one string pool
+    std::string strings;
+    auto pool = [&strings](const std::vector<std::string>& texts) {
+        std::vector<std::uint32_t> offsets = {static_cast<std::uint32_t>(strings.size())};
+        std::for_each(texts.begin(), texts.end(), [&](const std::string& text) {
+            strings += text;
+            offsets.push_back(static_cast<std::uint32_t>(strings.size()));
+        });
+        return offsets;
+    };
+    const auto wordOffsets = pool(keys);
+    const auto nameOffsets = pool(lexicon.names);
+
+    const auto& phrases = lexicon.phrases;
+    LexiconFileHeader header;
+    header.categoryCount = static_cast<std::uint32_t>(lexicon.names.size());
+    header.wordCount = static_cast<std::uint32_t>(keys.size());
+    header.bucketCount = static_cast<std::uint32_t>(layout.displacements.size());
+    header.slotCount = static_cast<std::uint32_t>(layout.slotKeys.size());
+    header.stateCount = static_cast<std::uint32_t>(phrases.fail.size());
+    header.edgeCount = static_cast<std::uint32_t>(phrases.edgeSymbols.size());
+    header.outputCount = static_cast<std::uint32_t>(phrases.outputs.size());
+    header.rootNextCount = static_cast<std::uint32_t>(phrases.rootNext.size());
+    header.phraseCount = static_cast<std::uint32_t>(phrases.phrases.size());
+    header.stringBytes = static_cast<std::uint32_t>(strings.size());
+
+    std::string image(reinterpret_cast<const char*>(&header), sizeof(header));
+    auto append = [&image](const auto& array) {
+        image.resize((image.size() + 7) / 8 * 8, '\0');
+        image.append(reinterpret_cast<const char*>(array.data()), array.size() * sizeof(*array.data()));
+    };
+    append(layout.displacements);
+    append(layout.slotKeys);
+    append(lexicon.masks);
+    append(wordOffsets);
+    append(nameOffsets);
+    append(phrases.edgeBegin);
+    append(phrases.edgeSymbols);
+    append(phrases.edgeTargets);
+    append(phrases.fail);
+    append(phrases.outputBegin);
+    append(phrases.outputs);
+    append(phrases.rootNext);
+    append(phrases.phrases);
+    append(strings);
+
+    std::ofstream file(fileName, std::ios::binary);
+    file.write(image.data(), static_cast<std::streamsize>(image.size()));
+    return static_cast<bool>(file);
+};
+
+/// @brief A compiled lexicon mapped into memory
+/// Opening checks the header, the array sizes and every index stored in the arrays, in one pass
+/// over the file; nothing is parsed or rebuilt: the perfect hash, the category masks and the
+/// phrase automaton are used straight from the mapping.
+class LexiconFile {
+public:
+    /// @brief Map a lexicon file
+    /// @param fileName The name of the file
+    /// @return The lexicon, or std::nullopt if the file cannot be mapped or is no lexicon of this version
+    static std::optional<LexiconFile> open(const std::string& fileName) {
+        auto document = MappedDocument::open(fileName, MappedDocument::Access::Random);
+        if (!document || document->size() < sizeof(LexiconFileHeader)) {
+            return std::nullopt;
+        }
+        LexiconFileHeader header;
+        std::memcpy(&header, document->text().data(), sizeof(header));
+        if (header.magic != lexiconFileMagic || header.version != lexiconFileVersion) {
+            return std::nullopt;
+        }
+
+        LexiconFile file(std::move(*document), header);
+        if (!file.mapArrays()) {
+            return std::nullopt;
+        }
+        return file;
+    }
+
+    /// @brief Look up a token in the perfect hash
+    /// @return The local id of the token, or std::nullopt if it is no word of the lexicon
+    std::optional<TermId> find(std::string_view token) const {
+        const std::uint64_t hash = hashToken(token);
+        const std::uint32_t displacement = displacements_[perfectHashBucket(hash, displacements_.size())];
+        const std::int32_t id = slotWords_[perfectHashSlot(hash, displacement, slotWords_.size() - 1)];
+        return id >= 0 && word(static_cast<TermId>(id)) == token ? std::optional<TermId>(static_cast<TermId>(id)) : std::nullopt;
+    }
+
+    /// @brief Local ids of a token sequence; tokens that are no words of the lexicon get wordCount()
+    /// @param tokens The tokens, a TokenList or any sequence of string views
+    /// @return The ids, ready for matchCategories and matchPhrases
+    template <typename Tokens>
+    std::vector<TermId> termIds(const Tokens& tokens) const {
+        const auto unknown = static_cast<TermId>(wordCount());
+        std::vector<TermId> ids;
+        ids.reserve(tokens.size());
+        std::transform(tokens.begin(), tokens.end(), std::back_inserter(ids),
+                       [this, unknown](std::string_view token) { return find(token).value_or(unknown); });
+        return ids;
+    }
+
+    std::size_t wordCount() const { return masks_.size(); }
+
+    std::string_view word(TermId id) const {
+        return strings_.substr(wordOffsets_[id], wordOffsets_[id + 1] - wordOffsets_[id]);
+    }
+
+    /// @brief The categories of a local id as a single term, 0 for ids that are in no category
+    CategoryMask maskOf(TermId id) const { return id < masks_.size() ? masks_[id] : 0; }
+
+    std::size_t categoryCount() const { return nameOffsets_.size() - 1; }
+
+    std::string_view name(std::size_t category) const {
+        return strings_.substr(nameOffsets_[category], nameOffsets_[category + 1] - nameOffsets_[category]);
+    }
+
+    const PhraseAutomatonView& phrases() const { return phrases_; }
+
+private:
+    LexiconFile(MappedDocument document, const LexiconFileHeader& header)
+        : document_(std::move(document)), header_(header) {}
+
+    /// @brief Point every array into the mapping, in file order
+    /// @return false if the file is too short or the arrays do not fit together
+    bool mapArrays() {
+        const std::string_view image = document_.text();
+        std::size_t offset = sizeof(LexiconFileHeader);
+        bool fits = true;
+        auto take = [&](auto& span, std::size_t count) {
+            using T = typename std::decay_t<decltype(span)>::value_type;
+            offset = (offset + 7) / 8 * 8;
+            fits = fits && offset + count * sizeof(T) <= image.size();
+            const T* first = fits ? reinterpret_cast<const T*>(image.data() + offset) : nullptr;
+            span = {first, fits ? first + count : nullptr};
+            offset += count * sizeof(T);
+        };
+
+        Span<char> strings;
+        take(displacements_, header_.bucketCount);
+        take(slotWords_, header_.slotCount);
+        take(masks_, header_.wordCount);
+        take(wordOffsets_, header_.wordCount + std::size_t{1});
+        take(nameOffsets_, header_.categoryCount + std::size_t{1});
+        take(phrases_.edgeBegin, header_.stateCount + std::size_t{1});
+        take(phrases_.edgeSymbols, header_.edgeCount);
+        take(phrases_.edgeTargets, header_.edgeCount);
+        take(phrases_.fail, header_.stateCount);
+        take(phrases_.outputBegin, header_.stateCount + std::size_t{1});
+        take(phrases_.outputs, header_.outputCount);
+        take(phrases_.rootNext, header_.rootNextCount);
+        take(phrases_.phrases, header_.phraseCount);
+        take(strings, header_.stringBytes);
+        if (!fits) {
+            return false;
+        }
+        strings_ = {strings.begin(), strings.size()};
+
+        // Constant-time consistency checks first, the arrays' contents after them
+        const bool powerOfTwo = header_.slotCount > 0 && (header_.slotCount & (header_.slotCount - 1)) == 0;
+        return powerOfTwo && header_.bucketCount > 0 && header_.stateCount > 0 &&
+               header_.categoryCount <= maxCategories && header_.rootNextCount <= header_.wordCount &&
+               wordOffsets_[header_.wordCount] <= nameOffsets_[0] && nameOffsets_[header_.categoryCount] <= header_.stringBytes &&
+               phrases_.edgeBegin[header_.stateCount] == header_.edgeCount &&
+               phrases_.outputBegin[header_.stateCount] == header_.outputCount && indicesValid();
+    }
+
+    /// @brief Check every index stored in the arrays against the array it points into
+    /// A damaged or foreign file is rejected here instead of being read out of bounds while matching.
+    /// @return false if an index is out of range, offsets decrease or the trie is malformed
+    bool indicesValid() const {
+        auto allBelow = [](const auto& values, std::uint64_t bound) {
+            return std::all_of(values.begin(), values.end(), [bound](auto value) { return std::uint64_t{value} < bound; });
+        };
+        const CategoryMask knownCategories =
+            header_.categoryCount == maxCategories ? ~CategoryMask{0} : (CategoryMask{1} << header_.categoryCount) - 1;
+        const auto& automaton = phrases_;
+        const bool arraysValid =
+            std::all_of(slotWords_.begin(), slotWords_.end(),
+                        [this](std::int32_t id) { return id >= -1 && id < static_cast<std::int64_t>(header_.wordCount); }) &&
+            std::all_of(masks_.begin(), masks_.end(), [knownCategories](CategoryMask mask) { return (mask & ~knownCategories) == 0; }) &&
+            std::is_sorted(wordOffsets_.begin(), wordOffsets_.end()) && std::is_sorted(nameOffsets_.begin(), nameOffsets_.end()) &&
+            std::is_sorted(automaton.edgeBegin.begin(), automaton.edgeBegin.end()) &&
+            std::is_sorted(automaton.outputBegin.begin(), automaton.outputBegin.end()) &&
+            allBelow(automaton.edgeTargets, header_.stateCount) && allBelow(automaton.fail, header_.stateCount) &&
+            allBelow(automaton.rootNext, header_.stateCount) && allBelow(automaton.outputs, header_.phraseCount) &&
+            std::all_of(automaton.phrases.begin(), automaton.phrases.end(), [this](const PhraseInfo& phrase) {
+                return phrase.category < header_.categoryCount && phrase.length > 0;
+            });
+        if (!arraysValid) {
+            return false;
+        }
+
+        // The trie: edges lead to later states and every state but the root has exactly one
+        // parent, so the depths are known in one pass in state order. Edges of a state are sorted
+        // for the binary search, and failure links lead closer to the root, so next() ends.
+        std::vector<std::uint32_t> depth(header_.stateCount, 0);
+        for (std::uint32_t state = 0; state < header_.stateCount; ++state) {
+            for (std::uint32_t edge = automaton.edgeBegin[state]; edge < automaton.edgeBegin[state + 1]; ++edge) {
+                const std::uint32_t target = automaton.edgeTargets[edge];
+                const bool sorted = edge == automaton.edgeBegin[state] || automaton.edgeSymbols[edge - 1] < automaton.edgeSymbols[edge];
+                if (target <= state || depth[target] != 0 || !sorted) {
+                    return false;
+                }
+                depth[target] = depth[state] + 1;
+            }
+        }
+        for (std::uint32_t state = 1; state < header_.stateCount; ++state) {
+            if (depth[state] == 0 || depth[automaton.fail[state]] >= depth[state]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    MappedDocument document_;
+    LexiconFileHeader header_;
+    Span<std::uint32_t> displacements_;
+    Span<std::int32_t> slotWords_;
+    Span<CategoryMask> masks_;
+    Span<std::uint32_t> wordOffsets_;
+    Span<std::uint32_t> nameOffsets_;
+    std::string_view strings_;
+    PhraseAutomatonView phrases_;
+};
@@ -1,238 +1,416 @@
-#include <iostream>
-#include <fstream>
-#include <vector>
-#include <string>
-#include <sstream>
-#include <iterator>
-#include <algorithm>
-#include <regex>
-#include <numeric>
-#include <map>
-#include <unordered_map>
-#include <functional>
-#include <optional>
-
-/// @brief Pure function to calculate the distances between occurences of words
-/// @param occurences A map of words to their positions in the text
-/// @return A map of words to their distances between occurences
-auto calculateDistances = [](const std::unordered_map<std::string, int>& occurences) {
-    std::map<std::string, std::vector<int>> distances;
-
-    // for each entry in occurences, initialize a vector dist, the size is the count of the word
-    // count of the word is the value of how many times the word appeared
-    // fill the vector with 0, 1, 2, 3, ..., count - 1, representing indices of the word
-    std::for_each(occurences.begin(), occurences.end(), [&](const auto& entry) {
-        const std::string& word = entry.first;
-        const int count = entry.second;
-
-        std::vector<int>& dist = distances[word];
-        dist.resize(count);
-
-        std::iota(dist.begin(), dist.end(), 0);
-    });
+#include "textual_tide.h"
+#include "document.h"
+#include "tokenizer.h"
+#include "symbols.h"
+#include "chapters.h"
+#include "lexicon.h"
+#include "phrases.h"
+#include "builtin_terms.h"
+#include "lexicon_file.h"
+#include "scheduler.h"
+#include "pipeline.h"
+#include "generator.h"
+#include "combinators.h"
+#include "inverted_index.h"
+#include "profile.h"
+#include "proximity.h"
+#include "kde.h"
+
+#include <charconv>
+#include <cmath>
+
+/// @brief Classify a chapter by the densities of war and peace terms
+/// @param warDensity The density of war terms in the chapter
+/// @param peaceDensity The density of peace terms in the chapter
+/// @return The theme of the chapter
+auto chapterTheme = [](double warDensity, double peaceDensity) -> std::string {
+    return (warDensity > peaceDensity) ? "war-related" : "peace-related";
+};
 
-    // for each entry in occurences, retrieve the vector dist from the distances map
-    // transform the values in dist, with respective indices, converting the distance vector
-    // to a vector of distances
-    std::for_each(occurences.begin(), occurences.end(), [&](const auto& entry) {
-        const std::string& word = entry.first;
+int main(int argc, char* argv[]) {
+    const std::string bookFilename = "war_and_peace.txt";
 
-        std::vector<int>& dist = distances[word];
-        int index = 0;
-        std::transform(dist.begin(), dist.end(), dist.begin(), [&index](int) { return index++; });
-    });
+    const std::vector<std::string> arguments(argv + 1, argv + argc);
+    auto hasFlag = [&arguments](const std::string& flag) {
+        return std::find(arguments.begin(), arguments.end(), flag) != arguments.end();
+    };
+    auto optionValue = [&arguments](const std::string& option) -> std::optional<std::string> {
+        const auto found = std::find(arguments.begin(), arguments.end(), option);
+        if (found == arguments.end() || std::next(found) == arguments.end()) {
+            return std::nullopt;
+        }
+        return *std::next(found);
+    };
 
-    return distances;
-};
+    auto textOf = [](const std::optional<MappedDocument>& document) {
+        return document ? document->text() : std::string_view{};
+    };
 
-/// @brief Pure function to calculate the density of a word in a chapter
-/// @param occurrences A map of words to their counts
-/// @param totalWordsInChapter The total number of words in the chapter
-/// @return The density of the word in the chapter
-auto calculateDensity = [](const std::unordered_map<std::string, int>& occurrences, int totalWordsInChapter) {
-    double totalOccurrences = std::accumulate(occurrences.begin(), occurrences.end(), 0,
-        [](const int previous, const std::pair<std::string, int>& p) { return previous + p.second; });
-    return totalWordsInChapter > 0 ? totalOccurrences / totalWordsInChapter : 0.0;
-};
+    // An option given last without its value would silently fall back to the default run
+    const std::vector<std::string> valueOptions = {"--threads", "--chunk-size", "--kde", "--near", "--profile", "--where",
+                                                   "--density", "--lexicon", "--category", "--war-terms", "--peace-terms"};
+    const auto missingValue = std::find_if(valueOptions.begin(), valueOptions.end(), [&](const std::string& option) {
+        return hasFlag(option) && !optionValue(option);
+    });
+    if (missingValue != valueOptions.end()) {
+        std::cerr << "Missing value of " << *missingValue << std::endl;
+        return 1;
+    }
+    // Each mode prints its own report, so only one of them can run
+    const std::vector<std::string> modeOptions = {"--stream", "--pipeline", "--kde", "--near", "--profile", "--where", "--sections"};
+    if (std::count_if(modeOptions.begin(), modeOptions.end(), hasFlag) > 1) {
+        std::cerr << "Only one of --stream, --pipeline, --kde, --near, --profile, --where and --sections can be given" << std::endl;
+        return 1;
+    }
 
-/// @brief Pure function to count occurences of words in a word list
-/// @param words The list of words to count
-/// @return A map of words to their counts
-auto countOccurences = [](const std::vector<std::string>& words) {
-    // Map step: Transform words into pairs of (word, 1)
-    // As such all pairs are initialized with a count of 1
-    auto map = [](const std::string& word) {
-        return std::make_pair(word, 1);
+    // Plain hit counts, or hits weighed by the distance to the previous hit of their category
+    const std::string densityName = optionValue("--density").value_or("frequency");
+    if (densityName != "frequency" && densityName != "proximity") {
+        std::cerr << "Unknown density " << densityName << ", use frequency or proximity" << std::endl;
+        return 1;
+    }
+    const DensityModel densityModel = densityName == "proximity" ? DensityModel::Proximity : DensityModel::Frequency;
+
+    /// @brief Parse the whole text of an option's value as a number of the type of value
+    /// @return False after a usage error if the text is not such a number; value is unchanged then
+    auto parseNumber = [](const std::string& option, const std::string& text, auto& value) {
+        const char* end = text.data() + text.size();
+        auto parsed = value;
+        const auto [last, error] = std::from_chars(text.data(), end, parsed);
+        if (text.empty() || error != std::errc() || last != end) {
+            std::cerr << "Invalid value " << text << " of " << option << ", expected a number" << std::endl;
+            return false;
+        }
+        value = parsed;
+        return true;
+    };
+    /// @brief Read a numeric option into value, which keeps its default if the option is not given
+    auto numberOption = [&](const std::string& option, auto& value) {
+        const auto text = optionValue(option);
+        return !text || parseNumber(option, *text, value);
     };
 
-    // Transform the words into pairs
-    std::vector<std::pair<std::string, int>> pairs;
-    std::transform(words.begin(), words.end(), std::back_inserter(pairs), map);
+    // Numeric options are checked before any work starts; chunks are smaller when pipelined, so
+    // all three stages get to run early
+    unsigned threadCount = 0;
+    std::size_t chunkSize = hasFlag("--pipeline") ? 65536 : 1048576;
+    double kdeWidth = 0.0;
+    std::uint32_t nearDistance = 0;
+    std::size_t profileWindow = 0;
+    if (!numberOption("--threads", threadCount) || !numberOption("--chunk-size", chunkSize) || !numberOption("--kde", kdeWidth) ||
+        !numberOption("--near", nearDistance) || !numberOption("--profile", profileWindow)) {
+        return 1;
+    }
+    // The stride of --profile is the optional second value, windows do not overlap without it
+    const auto profileArgument = std::find(arguments.begin(), arguments.end(), "--profile");
+    const bool hasStride = arguments.end() - profileArgument > 2 && !profileArgument[2].starts_with("--");
+    std::size_t profileStride = profileWindow;
+    if (hasStride && !parseNumber("--profile", profileArgument[2], profileStride)) {
+        return 1;
+    }
+    if (threadCount > maxThreadCount()) {
+        std::cerr << "Invalid value " << threadCount << " of --threads, at most " << maxThreadCount() << " threads are supported" << std::endl;
+        return 1;
+    }
+    if (chunkSize == 0) {
+        std::cerr << "The chunk size of --stream and --pipeline has to be positive" << std::endl;
+        return 1;
+    }
+    if (optionValue("--kde") && !(std::isfinite(kdeWidth) && kdeWidth > 0.0)) {
+        std::cerr << "The kernel width of --kde has to be positive and finite" << std::endl;
+        return 1;
+    }
+    // War and peace take two of the matcher's categories
+    const auto extraCategories = static_cast<std::size_t>(std::count(arguments.begin(), arguments.end(), "--category"));
+    if (extraCategories > maxCategories - 2) {
+        std::cerr << "At most " << maxCategories - 2 << " --category lists are supported" << std::endl;
+        return 1;
+    }
+
+    // The stages run as a task graph on one pool: the book is mapped and tokenized while the
+    // word lists load, interning the book waits for both, then the chapters spread over all workers
+    ThreadPool pool(threadCount);
+    std::optional<Task<std::optional<MappedDocument>>> mapTask;
+    std::optional<Task<ChapteredTokens>> tokenizeTask;
+    if (!hasFlag("--stream") && !hasFlag("--pipeline")) {
+        mapTask = pool.submit([&bookFilename]() { return mapFile(bookFilename); });
+        tokenizeTask = pool.submit([&textOf, mapped = *mapTask]() { return tokenizeChapters(textOf(mapped.result.get())); }, *mapTask);
+    }
 
-    // Reduce step: Reduce the pairs into a map of words to their counts
-    auto reduce = [](std::unordered_map<std::string, int>& result, const std::pair<std::string, int>& pair) {
-        result[pair.first] += pair.second;
+    // Every distinct token is interned once, from here on the pipeline works on ids.
+    // War and peace are categories 0 and 1, every "--category <name>=<file>" adds one more.
+    // Every line of a word list is one entry: single words go to the matcher, longer
+    // lines are phrases found by the automaton.
+    SymbolTable symbols;
+    CategoryMatcher matcher;
+    std::vector<PhraseEntry> phraseEntries;
+    auto addLexicon = [&](const std::string& name, std::string_view text) {
+        const auto entries = readLexiconEntries(text);
+        std::vector<std::string> words;
+        std::for_each(entries.begin(), entries.end(), [&](const auto& entry) {
+            if (entry.size() == 1) {
+                words.push_back(entry.front());
+            } else {
+                phraseEntries.push_back({entry, matcher.categoryCount()});
+            }
+        });
+        matcher.addCategory(symbols, name, words);
     };
 
-    // Iterate over each element in the pairs vector and reduce them using reduce function
-    // as such updating the counts of words in the result map.
-    std::unordered_map<std::string, int> result;
-    std::for_each(pairs.begin(), pairs.end(), std::bind(reduce, std::ref(result), std::placeholders::_1));
+    // War and peace terms are compiled into the binary (builtin_terms.h, generated from
+    // war_terms.txt and peace_terms.txt); "--war-terms" / "--peace-terms" read a list at runtime
+    auto addBuiltinLexicon = [&](std::size_t builtinCategory) {
+        std::for_each(builtinPhrases.begin(), builtinPhrases.end(), [&](const StaticPhrase& phrase) {
+            if (phrase.category == builtinCategory) {
+                const auto words = builtinPhraseWords.begin() + phrase.first;
+                phraseEntries.push_back({std::vector<std::string>(words, words + phrase.length), matcher.categoryCount()});
+            }
+        });
+        std::vector<std::string_view> words;
+        std::for_each(builtinTerms.begin(), builtinTerms.end(), [&](const StaticLexiconEntry& term) {
+            if (term.category == builtinCategory) {
+                words.push_back(term.text);
+            }
+        });
+        matcher.addCategory(symbols, std::string(builtinCategoryNames[builtinCategory]), words);
+    };
+    auto loadWordLists = [&]() {
+        for (std::size_t builtinCategory : {std::size_t{0}, std::size_t{1}}) {
+            const std::string name(builtinCategoryNames[builtinCategory]);
+            const auto termsFilename = optionValue("--" + name + "-terms");
+            if (!termsFilename) {
+                addBuiltinLexicon(builtinCategory);
+                continue;
+            }
+            // The file stays mapped while its terms are interned
+            const auto terms = mapFile(*termsFilename);
+            if (!terms) {
+                std::cerr << "Cannot load " << name << " terms " << *termsFilename << std::endl;
+                return false;
+            }
+            addLexicon(name, terms->text());
+        }
+        for (auto argument = arguments.begin(); argument != arguments.end(); ++argument) {
+            if (*argument != "--category" || std::next(argument) == arguments.end()) continue;
+            const std::string& definition = *std::next(argument);
+            const auto separator = definition.find('=');
+            const auto categoryTerms = separator != std::string::npos ? mapFile(definition.substr(separator + 1)) : std::nullopt;
+            if (!categoryTerms) {
+                std::cerr << "Cannot load category " << definition << std::endl;
+                return false;
+            }
+            addLexicon(definition.substr(0, separator), categoryTerms->text());
+        }
+        return true;
+    };
 
-    return result;
-};
+    // A compiled lexicon ("TextualTideLexc") replaces all word lists; it is matched straight
+    // from the mapping, with its own ids instead of the symbol table
+    std::optional<LexiconFile> lexicon;
+    const auto loadTask = pool.submit([&]() {
+        const auto lexiconFilename = optionValue("--lexicon");
+        if (!lexiconFilename) {
+            return loadWordLists();
+        }
+        lexicon = LexiconFile::open(*lexiconFilename);
+        if (!lexicon || lexicon->categoryCount() < 2) {
+            std::cerr << "Cannot load lexicon " << *lexiconFilename << std::endl;
+            return false;
+        }
+        return true;
+    });
+    if (!pool.wait(loadTask)) {
+        return 1;
+    }
+    const auto phrases = buildPhraseAutomaton(symbols, phraseEntries);
 
-/// @brief Pure function to filter words from a word list
-/// @param wordList The list of all words to filter
-/// @param filterList The list of words to filter out
-/// @return The filtered list of words
-auto filterWords = [](const std::vector<std::string>& filterList) {
-    return [filterList](const std::vector<std::string>& wordList) {
-        std::vector<std::string> result;
-
-        // if the word from wordList is in filterList, copy it to result
-        std::copy_if(wordList.begin(), wordList.end(), std::back_inserter(result), [&filterList](const std::string& word) {
-            return std::find(filterList.begin(), filterList.end(), word) != filterList.end();
-        });
+    /// @brief The ids of a token sequence, for the lexicon or the word lists in use
+    auto idsOf = [&](const auto& tokens) {
+        return lexicon ? lexicon->termIds(tokens) : internTokens(symbols, tokens);
+    };
 
-        return result;
+    /// @brief Densities of all categories in the interned tokens of one chapter, one fused pass over the chapter
+    auto chapterDensities = [&](const auto& chapterIds) {
+        return lexicon ? chapterIds | categoryDensities(*lexicon, lexicon->phrases(), densityModel)
+                       : chapterIds | categoryDensities(matcher, phrases, densityModel);
     };
-};
 
+    auto categoryName = [&](std::size_t category) {
+        return lexicon ? std::string(lexicon->name(category)) : matcher.name(category);
+    };
 
+    /// @brief The report line of a chapter; additional categories are listed with their densities
+    auto reportLine = [&](const std::string& label, const std::vector<double>& densities) {
+        std::string line = label + ": " + chapterTheme(densities[0], densities[1]);
+        for (std::size_t category = 2; category < densities.size(); ++category) {
+            line += (category == 2 ? " (" : ", ") + categoryName(category) + " " + std::to_string(densities[category]);
+        }
+        return densities.size() > 2 ? line + ")" : line;
+    };
 
-// Pure function to read files
-/// @brief Read file contents into a string
-/// @param fileName The name of the file to read
-/// @return The contents of the file
-auto readFile = [](const std::string& fileName) -> std::optional<std::string> {
-    std::ifstream file(fileName);
-    if (!file.is_open()) {
-        return std::nullopt;
+    if (hasFlag("--stream")) {
+        // Streaming mode: chunks, tokens and chapters are pulled lazily through generators, only the
+        // current chapter is in memory; chapters are classified and printed as soon as they are complete
+        for (const ChapterTokens& chapter : chaptersOf(tokensOf(chunksOf(bookFilename, chunkSize)))) {
+            if (chapter.number == 0) continue; // Skip the the words before the first chapter
+            const auto densities = chapterDensities(idsOf(chapter.tokens));
+            std::cout << reportLine("Chapter " + std::to_string(chapter.number), densities) << std::endl;
+        }
+        return 0;
     }
-    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
-};
-
-/// @brief Tokenize the input text
-/// @param optionalInputText The input text to tokenize
-/// @return A vector of tokens
-auto tokenize = [](const std::optional<std::string>& optionalInputText) -> std::vector<std::string> {
-    if (!optionalInputText) {
-        return {}; // Return an empty vector if there's no input text
-    }
-
-    const std::string& inputText = *optionalInputText;
-    // Replace "CHAPTER <number>" with "CHAPTER_<number>"
-    std::regex chapterPattern(R"(CHAPTER (\d+))");
-    std::string processedText = std::regex_replace(inputText, chapterPattern, "CHAPTER_$1");
-    
-    std::istringstream stream(processedText);
-    const std::vector<std::string> tokens((std::istream_iterator<std::string>(stream)), std::istream_iterator<std::string>());
-
-    // Map step: Transform tokens
-    const auto filteredTokens = [&tokens]() {
-        std::vector<std::string> result;
-        std::transform(tokens.begin(), tokens.end(), std::back_inserter(result),
-                       [](const std::string& token) {
-                           std::string filtered;
-                           std::copy_if(token.begin(), token.end(), std::back_inserter(filtered),
-                                        [](char c) { return std::isalpha(c) || std::isdigit(c) || c == '_'; });
-                           return filtered;
-                       });
-        return result;
-    }();
-
-    // Reduce step: Filter out empty tokens
-    const auto nonEmptyTokens = [&filteredTokens]() {
-        std::vector<std::string> result;
-        std::copy_if(filteredTokens.begin(), filteredTokens.end(), std::back_inserter(result),
-                     [](const std::string& token) { return !token.empty(); });
-        return result;
-    }();
-
-    return nonEmptyTokens;
-};
 
-/// @brief Split the tokens by chapter
-/// @param tokens The tokens to split
-/// @return A map of chapter numbers to their tokens
-auto splitByChapter = [](const std::vector<std::string>& tokens) {
-    std::map<int, std::vector<std::string>> chapters;
-    std::regex chapterPattern(R"(CHAPTER_\d+)");
-    int chapterIndex = 0;
-
-    // Use std::for_each to iterate over the tokens
-    std::for_each(tokens.begin(), tokens.end(), [&chapters, &chapterIndex, &chapterPattern](const std::string& token) {
-        if (std::regex_match(token, chapterPattern)) {
-            // Start a new chapter
-            chapterIndex++;
-        } else {
-            // Add token to the current chapter's vector
-            chapters[chapterIndex].push_back(token);
+    if (hasFlag("--pipeline")) {
+        // Pipelined mode: reading, tokenizing and classifying overlap on their own threads
+        const bool opened = pipelineChapters(bookFilename, chunkSize, idsOf, [&](int chapterNum, const std::vector<TermId>& chapterIds) {
+            if (chapterNum == 0) return; // Skip the the words before the first chapter
+            std::cout << reportLine("Chapter " + std::to_string(chapterNum), chapterDensities(chapterIds)) << std::endl;
+        });
+        if (!opened) {
+            std::cerr << "Cannot load book " << bookFilename << std::endl;
+            return 1;
         }
-    });
+        return 0;
+    }
 
-    // If the first token is not a chapter and chapterIndex is still 0, remove the entry.
-    if (chapterIndex == 0) {
-        chapters.erase(chapterIndex);
+    // Chapter boundaries are found while tokenizing, chapters are spans of the interned book
+    const auto internTask = pool.submit([&]() { return idsOf(tokenizeTask->result.get().tokens); }, *tokenizeTask, loadTask);
+    const auto& bookIds = pool.wait(internTask);
+    const auto& tokenizedBookContent = pool.wait(*tokenizeTask);
+    const auto& chapters = tokenizedBookContent.chapters.ranges;
+
+    if (optionValue("--kde")) {
+        // Smoothing mode: kernel densities of the whole book by FFT convolution, then the points
+        // inside every chapter where the lead between war and peace changes
+        const auto shapeArgument = std::next(std::find(arguments.begin(), arguments.end(), "--kde"), 2);
+        const bool exponential = shapeArgument != arguments.end() && *shapeArgument == "exponential";
+        const auto sums = lexicon ? bookIds | categoryPrefixSums(*lexicon, lexicon->phrases()) : bookIds | categoryPrefixSums(matcher, phrases);
+        const auto curves = kernelDensities(sums, smoothingKernel(exponential ? KernelShape::Exponential : KernelShape::Gaussian, kdeWidth, bookIds.size()));
+
+        auto leaderName = [&](const Transition& transition) { return categoryName(transition.toFirst ? 0 : 1); };
+        for (std::size_t chapterNum = 1; chapterNum < chapters.size(); ++chapterNum) {
+            const auto transitions = findTransitions(curves[0], curves[1], chapters[chapterNum]);
+            if (transitions.empty()) continue;
+            std::string line = "Chapter " + std::to_string(chapterNum) + ": " + leaderName(transitions.front());
+            std::for_each(std::next(transitions.begin()), transitions.end(), [&](const Transition& transition) {
+                line += ", " + leaderName(transition) + " from " + std::to_string(transition.position - chapters[chapterNum].begin);
+            });
+            std::cout << line << std::endl;
+        }
+        return 0;
     }
 
-    return chapters;
-};
+    if (optionValue("--near")) {
+        // Proximity mode: per chapter, the war hits with a peace hit within the distance and the
+        // distance of every war hit to its nearest peace hit, both by merging the hit positions
+        auto bookHits = [&bookIds](const auto& categories, const auto& automaton) {
+            auto hits = matchCategories(categories, bookIds);
+            addPhraseHits(hits, automaton, matchPhrases(automaton, bookIds));
+            return hits;
+        };
+        const auto hits = lexicon ? bookHits(*lexicon, lexicon->phrases()) : bookHits(matcher, phrases);
+        for (std::size_t chapterNum = 1; chapterNum < chapters.size(); ++chapterNum) {
+            const auto warHits = positionsIn(hits.positions[0], chapters[chapterNum]);
+            const auto peaceHits = positionsIn(hits.positions[1], chapters[chapterNum]);
+            if (warHits.empty()) continue;
+            const auto nearest = nearestHits(warHits, peaceHits);
+            const double meanDistance = nearest.empty() ? 0.0 : std::accumulate(nearest.begin(), nearest.end(), 0.0, [](double total, const ProximityHit& hit) {
+                return total + hit.distance();
+            }) / static_cast<double>(nearest.size());
+            std::cout << "Chapter " << chapterNum << ": " << hitsWithin(warHits, peaceHits, nearDistance).size() << " of " << warHits.size() << " "
+                      << categoryName(0) << " hits within " << nearDistance << " tokens of " << categoryName(1) << ", mean distance to the nearest "
+                      << (nearest.empty() ? std::string("-") : std::to_string(meanDistance)) << std::endl;
+        }
+        return 0;
+    }
 
-int main() {
-    const std::string bookFilename = "war_and_peace.txt";
-    const std::string warTermsFilename = "war_terms.txt";
-    const std::string peaceTermsFilename = "peace_terms.txt";
-
-    const auto bookContent = readFile(bookFilename);
-    const auto warTerms = readFile(warTermsFilename);
-    const auto peaceTerms = readFile(peaceTermsFilename);
-
-    const auto tokenizedBookContent = tokenize(bookContent);
-    const auto chapters = splitByChapter(tokenizedBookContent);
-    
-    const auto tokenizedWarTerms = tokenize(warTerms);
-    const auto tokenizedPeaceTerms = tokenize(peaceTerms);
-
-    std::map<int, double> warDensities;
-    std::map<int, double> peaceDensities;
-    // Processing each chapter
-    std::for_each(chapters.begin(), chapters.end(), [&](const auto& chapterPair) {
-        auto chapterNum = chapterPair.first;
-        const auto& chapterContent = chapterPair.second;
-
-        // Create filtered content
-        auto filteredWarContent = filterWords(tokenizedWarTerms)(chapterContent);
-        auto filteredPeaceContent = filterWords(tokenizedPeaceTerms)(chapterContent);
-
-        // Count occurrences
-        auto warCounts = countOccurences(filteredWarContent);
-        auto peaceCounts = countOccurences(filteredPeaceContent);
-
-        // Calculate densities
-        double warDensity = calculateDensity(warCounts, chapterContent.size());
-        double peaceDensity = calculateDensity(peaceCounts, chapterContent.size());
-
-        // Assign chapter densities
-        warDensities[chapterNum] = warDensity;
-        peaceDensities[chapterNum] = peaceDensity;
-    });
+    if (optionValue("--profile")) {
+        // Profile mode: density curves over a sliding window, from the running hit counts of the whole book
+        if (profileWindow == 0 || profileStride == 0) {
+            std::cerr << "Window and stride of --profile have to be positive" << std::endl;
+            return 1;
+        }
+        const auto sums = lexicon ? bookIds | categoryPrefixSums(*lexicon, lexicon->phrases()) : bookIds | categoryPrefixSums(matcher, phrases);
+        const auto profile = densityProfile(sums, profileWindow, profileStride);
 
-    // Determine the theme of each chapter based on the densities
-    std::for_each(warDensities.begin(), warDensities.end(), [&](const auto& warDensityPair) {
-        auto chapterNum = warDensityPair.first;
-        if(chapterNum == 0) return; // Skip the the words before the first chapter
-        auto warDensity = warDensityPair.second;
-        auto peaceDensity = peaceDensities[chapterNum];
-
-        std::string chapterTheme = (warDensity > peaceDensity) ? "war-related" : "peace-related";
-        std::cout << "Chapter " << chapterNum << ": " << chapterTheme << std::endl;
-    });
+        std::cout << "# token chapter";
+        for (std::size_t category = 0; category < profile.densities.size(); ++category) {
+            std::cout << " " << categoryName(category);
+        }
+        std::cout << "\n";
+        std::size_t chapterNum = 0;
+        for (std::size_t point = 0; point < profile.starts.size(); ++point) {
+            // Windows and chapters are both in book order
+            while (chapterNum + 1 < chapters.size() && chapters[chapterNum + 1].begin <= profile.starts[point]) {
+                ++chapterNum;
+            }
+            std::cout << profile.starts[point] << "\t" << chapterNum;
+            for (const auto& curve : profile.densities) {
+                std::cout << "\t" << std::to_string(curve[point]);
+            }
+            std::cout << "\n";
+        }
+        return 0;
+    }
 
-    return 0;
-}
+    if (const auto word = optionValue("--where")) {
+        // Index mode: the book is indexed once, the occurences of the word are read from its posting list
+        const auto index = buildPositionalIndex(bookIds, tokenizedBookContent.chapters);
+        const auto queryTokens = tokenizeView(*word);
+        const auto term = queryTokens.empty() ? std::nullopt : lexicon ? lexicon->find(*queryTokens.begin()) : symbols.find(*queryTokens.begin());
+        if (!term) {
+            std::cout << *word << ": 0 hits" << std::endl;
+            return 0;
+        }
+        std::cout << *word << ": " << index.count(*term) << " hits" << std::endl;
+        for (std::size_t chapterNum = 1; chapterNum < chapters.size(); ++chapterNum) {
+            const auto positions = index.positions(*term, chapters[chapterNum]);
+            if (positions.empty()) continue;
+            const double meanGap = positions.size() > 1 ? static_cast<double>(positions.back() - positions.front()) / static_cast<double>(positions.size() - 1) : 0.0;
+            std::cout << "Chapter " << chapterNum << ": " << positions.size() << " hits, mean gap " << std::to_string(meanGap) << std::endl;
+        }
+        return 0;
+    }
 
+    if (hasFlag("--sections")) {
+        // Hierarchical mode: chapters are reported as (book, chapter), followed by the whole book
+        const auto sectionIndex = buildSectionIndex(tokenizedBookContent);
+        for (Part part : {Part::Book, Part::Epilogue}) {
+            const std::string partName = part == Part::Book ? "Book " : "Epilogue ";
+            const auto& books = sectionIndex.books[static_cast<std::size_t>(part)];
+            for (int book = 1; book < static_cast<int>(books.size()); ++book) {
+                const auto& chapterEntries = books[static_cast<std::size_t>(book)].chapters;
+                for (int chapterNum = 1; chapterNum < static_cast<int>(chapterEntries.size()); ++chapterNum) {
+                    const Section* section = sectionIndex.find(part, book, chapterNum);
+                    if (section == nullptr) continue;
+                    const auto densities = chapterDensities(spanOf(bookIds, section->range));
+                    std::cout << reportLine(partName + std::to_string(book) + ", Chapter " + std::to_string(chapterNum), densities)
+                              << std::endl;
+                }
+                const auto densities = chapterDensities(spanOf(bookIds, sectionIndex.bookRange(part, book)));
+                std::cout << reportLine(partName + std::to_string(book), densities) << std::endl;
+            }
+        }
+        return 0;
+    }
 
+    // Densities of every category, per chapter; chapters are classified in parallel, largest
+    // first, each into its own slot, and printed in order afterwards
+    std::vector<std::vector<double>> densities(chapters.size());
+    parallelForLargestFirst(
+        pool, chapters.size(), [&chapters](std::size_t chapterNum) { return chapters[chapterNum].size(); },
+        [&](std::size_t chapterNum) {
+            const auto chapterContent = spanOf(bookIds, chapters[chapterNum]);
+            if (chapterContent.empty()) return;
+
+            // Assign chapter densities
+            densities[chapterNum] = chapterDensities(chapterContent);
+        });
 
+    // Determine the theme of each chapter based on the densities
+    for (std::size_t chapterNum = 1; chapterNum < densities.size(); ++chapterNum) {
+        if (densities[chapterNum].empty()) continue; // Chapters without words have no theme
+        std::cout << reportLine("Chapter " + std::to_string(chapterNum), densities[chapterNum]) << std::endl;
+    }
 
+    return 0;
+}
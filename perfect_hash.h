@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "lexicon.h"
+
+/// @brief Bucket of a key in a perfect hash table with bucketCount buckets
+inline constexpr std::size_t perfectHashBucket(std::uint64_t hash, std::size_t bucketCount) {
+    // Multiply-shift range reduction of the high half, no division
+    return static_cast<std::size_t>(((hash >> 32) * bucketCount) >> 32);
+}
+
+/// @brief Slot of a key once its bucket's displacement is known
+/// The step is odd and the slot count a power of two, so displacements 0 .. slotCount - 1
+/// take a single key through every slot.
+inline constexpr std::size_t perfectHashSlot(std::uint64_t hash, std::uint32_t displacement, std::size_t slotMask) {
+    const std::uint64_t first = hash & 0xffffffffULL;
+    const std::uint64_t step = (hash >> 32) | 1;
+    return static_cast<std::size_t>((first + displacement * step) & slotMask);
+}
+
+/// @brief Result of buildPerfectHash
+struct PerfectHashLayout {
+    /// Displacement of every bucket
+    std::vector<std::uint32_t> displacements;
+    /// Index of the key stored in every slot, -1 for free slots; the size is a power of two
+    std::vector<std::int32_t> slotKeys;
+};
+
+/// @brief Find a collision free layout for a set of keys (hash and displace)
+/// Buckets are placed largest first; each gets the first displacement that moves all its keys
+/// to free slots. If a bucket finds none, the table is doubled and the search starts over.
+/// @param keys The distinct keys
+/// @return The displacements and the slot of every key
+inline auto buildPerfectHash = [](const std::vector<std::string>& keys) {
+    const std::size_t bucketCount = std::max<std::size_t>(1, keys.size() / 2);
+    std::vector<std::uint64_t> hashes(keys.size());
+    std::transform(keys.begin(), keys.end(), hashes.begin(), [](const std::string& key) { return hashToken(key); });
+
+    std::vector<std::vector<std::size_t>> buckets(bucketCount);
+    for (std::size_t key = 0; key < keys.size(); ++key) {
+        buckets[perfectHashBucket(hashes[key], bucketCount)].push_back(key);
+    }
+    std::vector<std::size_t> order(bucketCount);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&buckets](std::size_t a, std::size_t b) {
+        return buckets[a].size() > buckets[b].size();
+    });
+
+    // Try to place every bucket into a table of the given size
+    auto place = [&](std::size_t slotCount) -> std::optional<PerfectHashLayout> {
+        PerfectHashLayout layout{std::vector<std::uint32_t>(bucketCount, 0), std::vector<std::int32_t>(slotCount, -1)};
+        std::vector<std::size_t> slots;
+        for (std::size_t bucket : order) {
+            if (buckets[bucket].empty()) break;
+            std::uint32_t displacement = 0;
+            for (; displacement < slotCount; ++displacement) {
+                slots.clear();
+                const bool fits = std::all_of(buckets[bucket].begin(), buckets[bucket].end(), [&](std::size_t key) {
+                    const std::size_t slot = perfectHashSlot(hashes[key], displacement, slotCount - 1);
+                    const bool free = layout.slotKeys[slot] < 0 && std::find(slots.begin(), slots.end(), slot) == slots.end();
+                    slots.push_back(slot);
+                    return free;
+                });
+                if (fits) break;
+            }
+            if (displacement == slotCount) return std::nullopt;
+
+            layout.displacements[bucket] = displacement;
+            for (std::size_t i = 0; i < slots.size(); ++i) {
+                layout.slotKeys[slots[i]] = static_cast<std::int32_t>(buckets[bucket][i]);
+            }
+        }
+        return layout;
+    };
+
+    std::size_t slotCount = 8;
+    while (slotCount < keys.size() + keys.size() / 4) {
+        slotCount *= 2;
+    }
+    for (;; slotCount *= 2) {
+        if (auto layout = place(slotCount)) return *layout;
+    }
+};
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "tokenizer.h"
+#include "symbols.h"
+#include "lexicon.h"
+#include "chapters.h"
+
+/// @brief Split a word list into its entries, one per line
+/// Every line is tokenized like the book, so "cease-fire" becomes "ceasefire" and
+/// "field marshal" stays a two word phrase instead of two independent terms.
+/// @param text The content of the word list
+/// @return The tokens of every non-empty line
+inline auto readLexiconEntries = [](std::string_view text) {
+    std::vector<std::vector<std::string>> entries;
+    std::string scratch;
+
+    std::size_t lineStart = 0;
+    while (lineStart < text.size()) {
+        const std::size_t lineEnd = std::min(text.find('\n', lineStart), text.size());
+        std::vector<std::string> entry;
+        scanTokens(text.substr(lineStart, lineEnd - lineStart), true, scratch,
+                   [&entry](std::string_view token, bool) { entry.emplace_back(token); });
+        if (!entry.empty()) {
+            entries.push_back(std::move(entry));
+        }
+        lineStart = lineEnd + 1;
+    }
+
+    return entries;
+};
+
+/// @brief A multi-word entry of a lexicon
+struct PhraseEntry {
+    std::vector<std::string> words;
+    std::size_t category = 0;
+};
+
+/// @brief What the automaton knows about a phrase
+struct PhraseInfo {
+    std::uint32_t category = 0;
+    std::uint32_t length = 0;
+};
+
+/// @brief A phrase found in a token sequence
+struct PhraseMatch {
+    std::uint32_t phrase = 0;
+    /// Position of the first token of the phrase
+    std::uint32_t position = 0;
+};
+
+/// @brief Aho-Corasick automaton over term ids, finds all phrases in one linear scan
+/// The trie is stored in flat arrays: the edges of state s are edgeSymbols/edgeTargets in
+/// [edgeBegin[s], edgeBegin[s + 1]), sorted by symbol; outputs of s (its own phrases and those
+/// of its failure chain) are outputs in [outputBegin[s], outputBegin[s + 1]). The root's edges
+/// are also expanded into rootNext, indexed by term id, because most tokens start at the root.
+/// Array is std::vector for an automaton built in memory and Span for one mapped from a file.
+template <template <typename> class Array>
+struct BasicPhraseAutomaton {
+    Array<std::uint32_t> edgeBegin;
+    Array<TermId> edgeSymbols;
+    Array<std::uint32_t> edgeTargets;
+    Array<std::uint32_t> fail;
+    Array<std::uint32_t> outputBegin;
+    Array<std::uint32_t> outputs;
+    Array<std::uint32_t> rootNext;
+    Array<PhraseInfo> phrases;
+
+    /// @brief Follow a token from a state, taking failure links where there is no edge
+    std::uint32_t next(std::uint32_t state, TermId symbol) const {
+        while (state != 0) {
+            const auto first = edgeSymbols.begin() + edgeBegin[state];
+            const auto last = edgeSymbols.begin() + edgeBegin[state + 1];
+            const auto edge = std::lower_bound(first, last, symbol);
+            if (edge != last && *edge == symbol) {
+                return edgeTargets[static_cast<std::size_t>(edge - edgeSymbols.begin())];
+            }
+            state = fail[state];
+        }
+        return symbol < rootNext.size() ? rootNext[symbol] : 0;
+    }
+
+    bool empty() const { return phrases.empty(); }
+};
+
+template <typename T>
+using OwnedArray = std::vector<T>;
+
+using PhraseAutomaton = BasicPhraseAutomaton<OwnedArray>;
+using PhraseAutomatonView = BasicPhraseAutomaton<Span>;
+
+/// @brief Build the automaton of a set of phrases
+/// @param symbols The table the text is interned into, phrase words are interned into it
+/// @param phraseEntries The phrases, the index of an entry is its phrase id
+/// @return The automaton
+inline auto buildPhraseAutomaton = [](SymbolTable& symbols, const std::vector<PhraseEntry>& phraseEntries) {
+    // Build the trie with ordered children, so the flat edge lists come out sorted
+    std::vector<std::map<TermId, std::uint32_t>> children(1);
+    std::vector<std::vector<std::uint32_t>> ownOutputs(1);
+    PhraseAutomaton automaton;
+
+    std::for_each(phraseEntries.begin(), phraseEntries.end(), [&](const PhraseEntry& entry) {
+        std::uint32_t state = 0;
+        std::for_each(entry.words.begin(), entry.words.end(), [&](const std::string& word) {
+            const TermId symbol = symbols.intern(word);
+            const auto found = children[state].find(symbol);
+            if (found != children[state].end()) {
+                state = found->second;
+                return;
+            }
+            const auto created = static_cast<std::uint32_t>(children.size());
+            children[state].emplace(symbol, created);
+            children.emplace_back();
+            ownOutputs.emplace_back();
+            state = created;
+        });
+        ownOutputs[state].push_back(static_cast<std::uint32_t>(automaton.phrases.size()));
+        automaton.phrases.push_back({static_cast<std::uint32_t>(entry.category), static_cast<std::uint32_t>(entry.words.size())});
+    });
+
+    // Breadth-first: the failure target of a state is always closer to the root, so its
+    // failure link and outputs are final by the time the state is visited
+    const std::size_t stateCount = children.size();
+    automaton.fail.assign(stateCount, 0);
+    std::vector<std::vector<std::uint32_t>> allOutputs(stateCount);
+    std::deque<std::uint32_t> queue;
+    std::for_each(children[0].begin(), children[0].end(), [&](const auto& edge) { queue.push_back(edge.second); });
+    while (!queue.empty()) {
+        const std::uint32_t state = queue.front();
+        queue.pop_front();
+
+        allOutputs[state] = ownOutputs[state];
+        const auto& inherited = allOutputs[automaton.fail[state]];
+        allOutputs[state].insert(allOutputs[state].end(), inherited.begin(), inherited.end());
+
+        std::for_each(children[state].begin(), children[state].end(), [&](const auto& edge) {
+            std::uint32_t fallback = automaton.fail[state];
+            while (true) {
+                const auto found = children[fallback].find(edge.first);
+                if (found != children[fallback].end()) {
+                    automaton.fail[edge.second] = found->second;
+                    break;
+                }
+                if (fallback == 0) {
+                    break;
+                }
+                fallback = automaton.fail[fallback];
+            }
+            queue.push_back(edge.second);
+        });
+    }
+
+    // Flatten into the arrays
+    automaton.edgeBegin.assign(1, 0);
+    automaton.outputBegin.assign(1, 0);
+    for (std::size_t state = 0; state < stateCount; ++state) {
+        std::for_each(children[state].begin(), children[state].end(), [&](const auto& edge) {
+            automaton.edgeSymbols.push_back(edge.first);
+            automaton.edgeTargets.push_back(edge.second);
+        });
+        automaton.edgeBegin.push_back(static_cast<std::uint32_t>(automaton.edgeSymbols.size()));
+        automaton.outputs.insert(automaton.outputs.end(), allOutputs[state].begin(), allOutputs[state].end());
+        automaton.outputBegin.push_back(static_cast<std::uint32_t>(automaton.outputs.size()));
+    }
+    std::for_each(children[0].begin(), children[0].end(), [&](const auto& edge) {
+        if (edge.first >= automaton.rootNext.size()) {
+            automaton.rootNext.resize(edge.first + 1, 0);
+        }
+        automaton.rootNext[edge.first] = edge.second;
+    });
+
+    return automaton;
+};
+
+/// @brief Find all phrases in a token sequence in a single pass
+/// @param automaton The phrases, a PhraseAutomaton or a PhraseAutomatonView
+/// @param ids The interned tokens, a vector or a Span of ids
+/// @return Every occurrence of every phrase, ordered by the position where it ends
+inline auto matchPhrases = [](const auto& automaton, const auto& ids) {
+    std::vector<PhraseMatch> matches;
+    if (automaton.empty()) {
+        return matches;
+    }
+
+    std::uint32_t state = 0;
+    std::uint32_t position = 0;
+    std::for_each(ids.begin(), ids.end(), [&](TermId id) {
+        state = automaton.next(state, id);
+        ++position;
+        for (std::uint32_t output = automaton.outputBegin[state]; output < automaton.outputBegin[state + 1]; ++output) {
+            const std::uint32_t phrase = automaton.outputs[output];
+            matches.push_back({phrase, position - automaton.phrases[phrase].length});
+        }
+    });
+
+    return matches;
+};
+
+/// @brief Add phrase matches to the single word hits of the same token sequence
+/// A phrase counts as one hit of its category at the position of its last token, where the
+/// automaton finds it; categoryDensities and categoryPrefixSums place it there as well.
+/// @param hits The hits from matchCategories, positions stay sorted
+/// @param automaton The automaton that produced the matches
+/// @param matches The result of matchPhrases on the same sequence
+inline auto addPhraseHits = [](CategoryHits& hits, const auto& automaton, const std::vector<PhraseMatch>& matches) {
+    std::vector<std::size_t> firstAdded(hits.positions.size());
+    for (std::size_t category = 0; category < hits.positions.size(); ++category) {
+        firstAdded[category] = hits.positions[category].size();
+    }
+
+    // Matches are ordered by their end, so the added positions are sorted already
+    std::for_each(matches.begin(), matches.end(), [&](const PhraseMatch& match) {
+        const PhraseInfo& phrase = automaton.phrases[match.phrase];
+        ++hits.counts[phrase.category];
+        hits.positions[phrase.category].push_back(match.position + phrase.length - 1);
+    });
+
+    for (std::size_t category = 0; category < hits.positions.size(); ++category) {
+        auto& positions = hits.positions[category];
+        std::inplace_merge(positions.begin(), positions.begin() + static_cast<std::ptrdiff_t>(firstAdded[category]), positions.end());
+    }
+};
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "document.h"
+#include "tokenizer.h"
+#include "symbols.h"
+
+/// @brief Bounded lock-free ring buffer between exactly one producer and one consumer thread
+/// The producer only writes tail_, the consumer only writes head_; each side caches the other's
+/// index and reloads it only when the ring looks full or empty, so a transfer usually touches
+/// no shared cache line but the slot itself. Blocking calls spin with yields.
+template <typename T>
+class SpscRing {
+public:
+    /// @param capacity The number of items in flight, rounded up to a power of two
+    explicit SpscRing(std::size_t capacity) {
+        std::size_t size = 2;
+        while (size < capacity) {
+            size *= 2;
+        }
+        slots_ = std::make_unique<std::optional<T>[]>(size);
+        mask_ = size - 1;
+    }
+
+    /// @brief Add an item unless the ring is full
+    /// @return false if the ring is full, the item is left untouched
+    bool tryPush(T& item) {
+        const std::size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - cachedHead_ > mask_) {
+            cachedHead_ = head_.load(std::memory_order_acquire);
+            if (tail - cachedHead_ > mask_) return false;
+        }
+        slots_[tail & mask_] = std::move(item);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// @brief Add an item, waiting while the ring is full
+    /// @return false if the ring was cancelled, the item is dropped then
+    bool push(T item) {
+        while (!tryPush(item)) {
+            if (cancelled_.load(std::memory_order_acquire)) return false;
+            std::this_thread::yield();
+        }
+        return true;
+    }
+
+    /// @brief No more items will be pushed; the consumer drains the ring and then sees the end
+    void close() { closed_.store(true, std::memory_order_release); }
+
+    /// @brief Give up the transfer; waiting pushes fail and waiting pops end without draining
+    void cancel() { cancelled_.store(true, std::memory_order_release); }
+
+    /// @brief Take the oldest item, if there is one
+    std::optional<T> tryPop() {
+        const std::size_t head = head_.load(std::memory_order_relaxed);
+        if (head == cachedTail_) {
+            cachedTail_ = tail_.load(std::memory_order_acquire);
+            if (head == cachedTail_) return std::nullopt;
+        }
+        std::optional<T> item = std::move(slots_[head & mask_]);
+        slots_[head & mask_].reset();
+        head_.store(head + 1, std::memory_order_release);
+        return item;
+    }
+
+    /// @brief Take the oldest item, waiting while the ring is empty
+    /// @return The item, or std::nullopt once the ring is closed and drained
+    std::optional<T> pop() {
+        while (true) {
+            if (auto item = tryPop()) return item;
+            // Closing happens after the last push, so an empty ring seen after the flag stays empty
+            if (closed_.load(std::memory_order_acquire)) return tryPop();
+            if (cancelled_.load(std::memory_order_acquire)) return std::nullopt;
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    std::unique_ptr<std::optional<T>[]> slots_;
+    std::size_t mask_ = 0;
+    // Producer and consumer indices live on separate cache lines
+    alignas(64) std::atomic<std::size_t> head_ = 0;
+    std::size_t cachedTail_ = 0;
+    alignas(64) std::atomic<std::size_t> tail_ = 0;
+    std::size_t cachedHead_ = 0;
+    alignas(64) std::atomic<bool> closed_ = false;
+    std::atomic<bool> cancelled_ = false;
+};
+
+/// @brief The interned tokens of one chapter, as handed from the tokenizer to the classifier
+struct ChapterIds {
+    int number = 0;
+    std::vector<TermId> ids;
+};
+
+/// @brief Read, tokenize and classify a book in three overlapping stages
+/// A reader thread reads chunks, a tokenizer thread splits them into chapters and interns them,
+/// and the calling thread classifies every chapter as soon as it is complete. The stages are
+/// connected by bounded SPSC rings, so a slow stage throttles the ones before it.
+/// @param fileName The name of the book
+/// @param chunkSize The number of bytes read at once, at least 1
+/// @param idsOf Turns the tokens of a chapter into ids; runs on the tokenizer thread only
+/// @param onChapter Called with every non-empty chapter, in order, on the calling thread
+/// @return False if the file cannot be opened or the chunk size is 0; no thread is started then
+/// @throw Whatever idsOf or onChapter throws, after both threads have been stopped and joined
+inline auto pipelineChapters = [](const std::string& fileName, std::size_t chunkSize, const auto& idsOf, const auto& onChapter) {
+    std::ifstream file(fileName, std::ios::binary);
+    if (chunkSize == 0 || !file.is_open()) {
+        return false;
+    }
+
+    // A few chunks and chapters in flight keep every stage busy without buffering the book
+    SpscRing<std::string> chunks(4);
+    SpscRing<ChapterIds> chapters(16);
+    std::exception_ptr readerError;
+    std::exception_ptr tokenizerError;
+    std::thread reader;
+    std::thread tokenizer;
+
+    // However this function is left, unblock both stages and join them; a joinable thread would terminate
+    struct StopAndJoin {
+        SpscRing<std::string>& chunks;
+        SpscRing<ChapterIds>& chapters;
+        std::thread& reader;
+        std::thread& tokenizer;
+        ~StopAndJoin() {
+            chunks.cancel();
+            chapters.cancel();
+            if (reader.joinable()) reader.join();
+            if (tokenizer.joinable()) tokenizer.join();
+        }
+    } stopAndJoin{chunks, chapters, reader, tokenizer};
+
+    reader = std::thread([&]() {
+        try {
+            bool lastChunk = false;
+            while (!lastChunk) {
+                std::string chunk(chunkSize, '\0');
+                file.read(chunk.data(), static_cast<std::streamsize>(chunkSize));
+                chunk.resize(static_cast<std::size_t>(file.gcount()));
+                lastChunk = !file;
+                if (!chunks.push(std::move(chunk))) break;
+            }
+        } catch (...) {
+            readerError = std::current_exception();
+        }
+        chunks.close();
+    });
+
+    tokenizer = std::thread([&]() {
+        try {
+            ChapterSplitter splitter;
+            bool cancelled = false;
+            auto handOn = [&](int chapterNumber, const TokenList& chapterTokens) {
+                if (!cancelled) cancelled = !chapters.push({chapterNumber, idsOf(chapterTokens)});
+            };
+            for (auto chunk = chunks.pop(); chunk && !cancelled; chunk = chunks.pop()) {
+                splitter.feed(*chunk, false, handOn);
+            }
+            splitter.feed({}, true, handOn);
+        } catch (...) {
+            tokenizerError = std::current_exception();
+            chunks.cancel(); // Lets the reader stop instead of waiting for a ring nobody drains
+        }
+        chapters.close();
+    });
+
+    for (auto chapter = chapters.pop(); chapter; chapter = chapters.pop()) {
+        onChapter(chapter->number, static_cast<const std::vector<TermId>&>(chapter->ids));
+    }
+    reader.join();
+    tokenizer.join();
+    if (readerError) std::rethrow_exception(readerError);
+    if (tokenizerError) std::rethrow_exception(tokenizerError);
+    return true;
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "combinators.h"
+
+/// @brief Running hit counts of every category over a token sequence
+/// prefix[c][i] is the number of hits of category c among the first i tokens, so the hits of any
+/// range [b, e) are prefix[c][e] - prefix[c][b], whatever its length.
+struct HitPrefixSums {
+    std::vector<std::vector<std::uint32_t>> prefix;
+
+    std::size_t categoryCount() const { return prefix.size(); }
+    std::size_t tokenCount() const { return prefix.empty() ? 0 : prefix.front().size() - 1; }
+
+    /// @brief The hits of a category in a range of the sequence
+    std::uint32_t hitsIn(std::size_t category, TokenRange range) const {
+        return prefix[category][range.end] - prefix[category][range.begin];
+    }
+};
+
+/// @brief Sink that gives the running hit counts of every category in a sequence of term ids
+/// Words and phrases are matched in one loop as in categoryDensities; a phrase counts at its last token.
+template <typename Matcher, typename Automaton>
+struct CategoryPrefixSink : PipeSink {
+    const Matcher& matcher;
+    const Automaton& automaton;
+
+    template <Pipeline Source>
+    HitPrefixSums drain(Source& source) const {
+        const std::size_t categoryCount = matcher.categoryCount();
+        HitPrefixSums sums;
+        sums.prefix.assign(categoryCount, std::vector<std::uint32_t>(1, 0));
+        std::vector<std::uint32_t> running(categoryCount, 0);
+
+        std::uint32_t state = 0;
+        auto add = [&](TermId id) {
+            for (CategoryMask mask = matcher.maskOf(id); mask != 0; mask &= mask - 1) {
+                ++running[static_cast<std::size_t>(__builtin_ctzll(mask))];
+            }
+            if (!automaton.empty()) {
+                state = automaton.next(state, id);
+                for (std::uint32_t output = automaton.outputBegin[state]; output < automaton.outputBegin[state + 1]; ++output) {
+                    ++running[automaton.phrases[automaton.outputs[output]].category];
+                }
+            }
+            for (std::size_t category = 0; category < categoryCount; ++category) {
+                sums.prefix[category].push_back(running[category]);
+            }
+        };
+        source.run(add);
+        return sums;
+    }
+};
+
+/// @brief The running hit counts of all categories, single words and phrases alike
+/// @param matcher The categories, anything with maskOf(id) and categoryCount() (CategoryMatcher, LexiconFile)
+/// @param automaton The phrases of the categories; both have to outlive the pipeline
+inline auto categoryPrefixSums = [](const auto& matcher, const auto& automaton) {
+    return CategoryPrefixSink<std::decay_t<decltype(matcher)>, std::decay_t<decltype(automaton)>>{{}, matcher, automaton};
+};
+
+/// @brief Density curves of all categories over a sliding window
+struct DensityProfile {
+    std::size_t window = 0;
+    std::size_t stride = 0;
+    /// First token of every window
+    std::vector<std::size_t> starts;
+    /// densities[c][k] is the density of category c in the window that starts at starts[k]
+    std::vector<std::vector<double>> densities;
+};
+
+/// @brief Slide a window over a token sequence and take the density of every category in it
+/// Every window is two lookups in the prefix sums, so the profile costs O(n / stride) per
+/// category, independent of the window size. Windows start at multiples of the stride and end
+/// inside the sequence; a sequence shorter than the window is a single window.
+/// @param sums The running hit counts of the sequence
+/// @param window The number of tokens per window, at least 1
+/// @param stride The distance between the starts of consecutive windows, at least 1
+/// @return The density curves
+inline auto densityProfile = [](const HitPrefixSums& sums, std::size_t window, std::size_t stride) {
+    DensityProfile profile;
+    profile.window = window;
+    profile.stride = stride;
+    profile.densities.resize(sums.categoryCount());
+
+    const std::size_t tokenCount = sums.tokenCount();
+    const std::size_t size = std::min(window, tokenCount);
+    for (std::size_t start = 0; size > 0 && start + size <= tokenCount; start += stride) {
+        profile.starts.push_back(start);
+    }
+    for (std::size_t category = 0; category < sums.categoryCount(); ++category) {
+        auto& curve = profile.densities[category];
+        curve.resize(profile.starts.size());
+        std::transform(profile.starts.begin(), profile.starts.end(), curve.begin(), [&](std::size_t start) {
+            return static_cast<double>(sums.hitsIn(category, {start, start + size})) / static_cast<double>(size);
+        });
+    }
+    return profile;
+};
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#include "chapters.h"
+
+/// Proximity queries between two sorted lists of hit positions, e.g. the positions of two
+/// categories from matchCategories or mergedPositions. Every query is a single linear merge of
+/// the two lists; per-chapter queries first cut the lists at the chapter bounds by binary search.
+
+/// @brief A hit and the hit of the other list nearest to it
+struct ProximityHit {
+    std::uint32_t position = 0;
+    std::uint32_t nearest = 0;
+
+    std::uint32_t distance() const { return position > nearest ? position - nearest : nearest - position; }
+};
+
+/// @brief The part of a sorted position list that falls into a range
+/// @param positions Ascending positions, a vector or a Span
+/// @param range The range, e.g. a chapter
+/// @return A view of the positions in [range.begin, range.end)
+inline auto positionsIn = [](const auto& positions, TokenRange range) {
+    const std::uint32_t* data = positions.empty() ? nullptr : &*positions.begin();
+    const std::uint32_t* end = data + positions.size();
+    const auto first = std::lower_bound(data, end, range.begin);
+    return Span<std::uint32_t>{first, std::lower_bound(first, end, range.end)};
+};
+
+/// @brief The nearest hit of the other list for every hit, in one merge
+/// @param hits Ascending positions of the hits to look from
+/// @param others Ascending positions of the hits to look for
+/// @return One entry per hit, in order; empty if there are no others. Ties go to the earlier hit.
+inline auto nearestHits = [](const auto& hits, const auto& others) {
+    std::vector<ProximityHit> result;
+    if (others.empty()) {
+        return result;
+    }
+    result.reserve(hits.size());
+
+    // next is the first other hit at or after the current hit; both only move forward
+    auto next = others.begin();
+    std::for_each(hits.begin(), hits.end(), [&](std::uint32_t position) {
+        while (next != others.end() && *next < position) {
+            ++next;
+        }
+        const bool hasNext = next != others.end();
+        const bool hasPrevious = next != others.begin();
+        const bool previousIsNearer = hasPrevious && (!hasNext || position - *std::prev(next) <= *next - position);
+        result.push_back({position, previousIsNearer ? *std::prev(next) : *next});
+    });
+    return result;
+};
+
+/// @brief The hits that have a hit of the other list within a distance, in one merge
+/// @param hits Ascending positions of the hits to look from
+/// @param others Ascending positions of the hits to look for
+/// @param distance The largest distance in tokens, in either direction
+/// @return The positions of the hits that qualify, in order
+inline auto hitsWithin = [](const auto& hits, const auto& others, std::uint32_t distance) {
+    std::vector<std::uint32_t> result;
+
+    // next is the first other hit not too far before the current hit
+    auto next = others.begin();
+    std::for_each(hits.begin(), hits.end(), [&](std::uint32_t position) {
+        while (next != others.end() && std::uint64_t{*next} + distance < position) {
+            ++next;
+        }
+        if (next != others.end() && *next <= std::uint64_t{position} + distance) {
+            result.push_back(position);
+        }
+    });
+    return result;
+};
+
+/// @brief The result of a proximity query in one chapter
+struct ChapterProximity {
+    int chapter = 0;
+    /// The hits that qualified, as positions in the book
+    std::vector<std::uint32_t> positions;
+};
+
+/// @brief Run a within-distance query in every chapter; hits only pair with hits of the same chapter
+/// @param chapters The chapter ranges of the book the positions belong to
+/// @param hits Ascending book positions of the hits to look from
+/// @param others Ascending book positions of the hits to look for
+/// @param distance The largest distance in tokens
+/// @return The chapters with at least one qualifying hit, in order
+inline auto hitsWithinByChapter = [](const ChapterIndex& chapters, const auto& hits, const auto& others, std::uint32_t distance) {
+    std::vector<ChapterProximity> result;
+    // Chapters are in book order, so both lists are cut with monotone cursors
+    Span<std::uint32_t> hitsLeft = positionsIn(hits, {0, ~std::size_t{0}});
+    Span<std::uint32_t> othersLeft = positionsIn(others, {0, ~std::size_t{0}});
+    for (std::size_t chapter = 0; chapter < chapters.ranges.size() && !hitsLeft.empty(); ++chapter) {
+        const TokenRange range = chapters.ranges[chapter];
+        const auto chapterHits = positionsIn(hitsLeft, range);
+        const auto chapterOthers = positionsIn(othersLeft, range);
+        hitsLeft.first = chapterHits.last;
+        othersLeft.first = chapterOthers.last;
+        if (chapterHits.empty()) continue;
+
+        auto positions = hitsWithin(chapterHits, chapterOthers, distance);
+        if (!positions.empty()) {
+            result.push_back({static_cast<int>(chapter), std::move(positions)});
+        }
+    }
+    return result;
+};
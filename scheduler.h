@@ -0,0 +1,242 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/// @brief The number of threads to use for a requested count
+/// @param requested The requested count, 0 for one thread per hardware thread
+inline auto resolveThreadCount = [](unsigned requested) {
+    return requested > 0 ? requested : std::max(1u, std::thread::hardware_concurrency());
+};
+
+/// @brief The most threads worth requesting: a few per hardware thread, more would only wait for each other
+inline auto maxThreadCount = []() {
+    return 8 * std::max(1u, std::thread::hardware_concurrency());
+};
+
+/// @brief Completion of a task, releases the tasks that depend on it
+class TaskNode {
+public:
+    /// @brief Run a continuation once the task is done, right away if it already is
+    void onDone(std::function<void()> continuation) {
+        {
+            const std::lock_guard<std::mutex> lock(mutex_);
+            if (!done_) {
+                continuations_.push_back(std::move(continuation));
+                return;
+            }
+        }
+        continuation();
+    }
+
+    /// @brief Mark the task as done and run its continuations
+    void finish() {
+        std::vector<std::function<void()>> continuations;
+        {
+            const std::lock_guard<std::mutex> lock(mutex_);
+            done_ = true;
+            continuations.swap(continuations_);
+        }
+        std::for_each(continuations.begin(), continuations.end(), [](const auto& continuation) { continuation(); });
+    }
+
+private:
+    std::mutex mutex_;
+    bool done_ = false;
+    std::vector<std::function<void()>> continuations_;
+};
+
+/// @brief Handle of a submitted task: its result and its place in the task graph
+template <typename R>
+struct Task {
+    std::shared_future<R> result;
+    std::shared_ptr<TaskNode> node;
+
+    bool ready() const { return result.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }
+};
+
+/// @brief Work-stealing thread pool running a graph of tasks
+/// Every worker owns a deque: it pushes and pops its own tasks at the back and steals from the
+/// front of the others when it runs dry. A task submitted with dependencies is queued only when
+/// the last of them is done, so a stage never occupies a thread while it waits for its inputs.
+/// wait() runs queued tasks while the awaited one is not done, so tasks may wait for tasks.
+/// The pool has to outlive every task submitted to it.
+class ThreadPool {
+public:
+    /// @param threadCount The number of workers, 0 for one per hardware thread
+    explicit ThreadPool(unsigned threadCount = 0) : queues_(resolveThreadCount(threadCount)) {
+        for (std::size_t worker = 0; worker < queues_.size(); ++worker) {
+            workers_.emplace_back([this, worker]() { work(worker); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /// @brief Run the tasks still queued, then stop the workers
+    ~ThreadPool() {
+        {
+            const std::lock_guard<std::mutex> lock(sleepMutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        std::for_each(workers_.begin(), workers_.end(), [](std::thread& worker) { worker.join(); });
+    }
+
+    /// @brief Submit a task that runs once all its dependencies are done
+    /// @param function The task, called without arguments; it reads its inputs from the dependency
+    /// handles it captured, which are ready when it runs. An exception ends up in its result.
+    /// @param dependencies Tasks that have to be done before this one starts
+    /// @return The handle of the task
+    template <typename F, typename... Dependencies>
+    auto submit(F function, const Task<Dependencies>&... dependencies) {
+        using R = std::invoke_result_t<F&>;
+        auto packaged = std::make_shared<std::packaged_task<R()>>(std::move(function));
+        Task<R> task{packaged->get_future().share(), std::make_shared<TaskNode>()};
+        std::function<void()> run = [packaged, node = task.node]() {
+            (*packaged)();
+            node->finish();
+        };
+
+        if constexpr (sizeof...(Dependencies) == 0) {
+            enqueue(std::move(run));
+        } else {
+            auto remaining = std::make_shared<std::atomic<std::size_t>>(sizeof...(Dependencies));
+            auto release = [this, remaining, run]() {
+                if (remaining->fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    enqueue(run);
+                }
+            };
+            (dependencies.node->onDone(release), ...);
+        }
+        return task;
+    }
+
+    /// @brief Wait for a task, running queued tasks in the meantime
+    /// @return The result of the task; rethrows its exception
+    template <typename R>
+    decltype(auto) wait(const Task<R>& task) {
+        const std::size_t self = currentPool_ == this ? currentWorker_ : noWorker;
+        while (!task.ready()) {
+            if (auto queued = take(self)) {
+                (*queued)();
+            } else {
+                task.result.wait_for(std::chrono::microseconds(50));
+            }
+        }
+        return task.result.get();
+    }
+
+    std::size_t threadCount() const { return queues_.size(); }
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void enqueue(std::function<void()> task) {
+        // A worker keeps its own follow-up tasks, everyone else spreads them round robin
+        const std::size_t worker = currentPool_ == this ? currentWorker_ : nextQueue_++ % queues_.size();
+        {
+            const std::lock_guard<std::mutex> lock(queues_[worker].mutex);
+            queues_[worker].tasks.push_back(std::move(task));
+        }
+        queued_.fetch_add(1, std::memory_order_release);
+        // Taking the sleep mutex orders the increment before a sleeping worker's check
+        { const std::lock_guard<std::mutex> lock(sleepMutex_); }
+        wake_.notify_one();
+    }
+
+    /// @brief The newest task of the own queue, or the oldest one of another queue
+    /// @param self The worker that takes, noWorker for threads outside the pool
+    std::optional<std::function<void()>> take(std::size_t self) {
+        if (queued_.load(std::memory_order_acquire) == 0) {
+            return std::nullopt;
+        }
+        const std::size_t first = self != noWorker ? self : nextQueue_ % queues_.size();
+        for (std::size_t offset = 0; offset < queues_.size(); ++offset) {
+            const std::size_t victim = (first + offset) % queues_.size();
+            const bool own = victim == self;
+            const std::lock_guard<std::mutex> lock(queues_[victim].mutex);
+            auto& tasks = queues_[victim].tasks;
+            if (tasks.empty()) continue;
+
+            std::function<void()> task = std::move(own ? tasks.back() : tasks.front());
+            own ? tasks.pop_back() : tasks.pop_front();
+            queued_.fetch_sub(1, std::memory_order_relaxed);
+            return task;
+        }
+        return std::nullopt;
+    }
+
+    void work(std::size_t worker) {
+        currentPool_ = this;
+        currentWorker_ = worker;
+        while (true) {
+            if (auto task = take(worker)) {
+                (*task)();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex_);
+            wake_.wait(lock, [this]() { return stopping_ || queued_.load(std::memory_order_acquire) > 0; });
+            if (stopping_ && queued_.load(std::memory_order_acquire) == 0) {
+                return;
+            }
+        }
+    }
+
+    static constexpr std::size_t noWorker = ~std::size_t{0};
+    static inline thread_local ThreadPool* currentPool_ = nullptr;
+    static inline thread_local std::size_t currentWorker_ = 0;
+
+    std::vector<WorkerQueue> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<std::size_t> queued_ = 0;
+    std::atomic<std::size_t> nextQueue_ = 0;
+    std::mutex sleepMutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+};
+
+/// @brief Run a task for every index on a pool, balancing uneven task sizes
+/// Tasks are handed out largest first (by the given cost) through a shared atomic counter: a
+/// thread takes the next task as soon as it is done with its last one, so the big tasks start
+/// early and the small ones fill the gaps at the end. The caller helps while it waits.
+/// @param pool The pool to run on
+/// @param count The number of tasks, they are numbered 0 .. count - 1
+/// @param costOf The estimated cost of a task, e.g. its token count
+/// @param task The task; tasks run concurrently and must only write their own results
+inline auto parallelForLargestFirst = [](ThreadPool& pool, std::size_t count, const auto& costOf, const auto& task) {
+    std::vector<std::size_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&costOf](std::size_t a, std::size_t b) { return costOf(a) > costOf(b); });
+
+    std::atomic<std::size_t> next = 0;
+    auto drain = [&]() {
+        for (std::size_t taken = next.fetch_add(1, std::memory_order_relaxed); taken < count;
+             taken = next.fetch_add(1, std::memory_order_relaxed)) {
+            task(order[taken]);
+        }
+    };
+
+    std::vector<Task<void>> drains;
+    for (std::size_t drainer = 0; drainer < std::min(pool.threadCount(), count); ++drainer) {
+        drains.push_back(pool.submit(drain));
+    }
+    std::for_each(drains.begin(), drains.end(), [&pool](const Task<void>& drainer) { pool.wait(drainer); });
+};
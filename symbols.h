@@ -0,0 +1,65 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "tokenizer.h"
+
+/// @brief Dense id of an interned token
+using TermId = std::uint32_t;
+
+/// @brief Interns every distinct token once and hands out dense ids 0, 1, 2, ...
+/// Ids are stable for the lifetime of the table, names are owned by the table.
+class SymbolTable {
+public:
+    /// @brief Get the id of a token, interning it on first sight
+    /// @param token The token to intern
+    /// @return The id of the token
+    TermId intern(std::string_view token) {
+        const auto found = ids_.find(token);
+        if (found != ids_.end()) {
+            return found->second;
+        }
+        const auto id = static_cast<TermId>(names_.size());
+        const auto name = storage_.store(token);
+        names_.push_back(name);
+        ids_.emplace(name, id);
+        return id;
+    }
+
+    /// @brief Look up a token without interning it
+    /// @return The id of the token, or std::nullopt if it was never interned
+    std::optional<TermId> find(std::string_view token) const {
+        const auto found = ids_.find(token);
+        return found != ids_.end() ? std::optional<TermId>(found->second) : std::nullopt;
+    }
+
+    /// @brief The token an id stands for
+    std::string_view name(TermId id) const { return names_[id]; }
+
+    /// @brief The number of distinct tokens, every id is below it
+    std::size_t size() const { return names_.size(); }
+
+private:
+    TokenArena storage_;
+    std::vector<std::string_view> names_;
+    std::unordered_map<std::string_view, TermId> ids_;
+};
+
+/// @brief Intern a token sequence
+/// @param symbols The table to intern into
+/// @param tokens The tokens to intern
+/// @return The ids of the tokens, in order
+inline auto internTokens = [](SymbolTable& symbols, const auto& tokens) {
+    std::vector<TermId> ids;
+    ids.reserve(tokens.size());
+    std::transform(tokens.begin(), tokens.end(), std::back_inserter(ids),
+                   [&symbols](std::string_view token) { return symbols.intern(token); });
+    return ids;
+};
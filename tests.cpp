@@ -1,206 +1,61 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
 
-#include <iostream>
-#include <fstream>
-#include <vector>
-#include <string>
-#include <sstream>
-#include <iterator>
-#include <algorithm>
-#include <regex>
-#include <numeric>
-#include <map>
-#include <unordered_map>
-#include <functional>
-#include <optional>
-
-auto calculateDistances = [](const std::unordered_map<std::string, int>& occurences) {
-    std::map<std::string, std::vector<int>> distances;
-
-    // for each entry in occurences, initialize a vector dist, the size is the count of the word
-    // count of the word is the value of how many times the word appeared
-    // fill the vector with 0, 1, 2, 3, ..., count - 1, representing indices of the word
-    std::for_each(occurences.begin(), occurences.end(), [&](const auto& entry) {
-        const std::string& word = entry.first;
-        const int count = entry.second;
-
-        std::vector<int>& dist = distances[word];
-        dist.resize(count);
-
-        std::iota(dist.begin(), dist.end(), 0);
-    });
-
-    // for each entry in occurences, retrieve the vector dist from the distances map
-    // transform the values in dist, with respective indices, converting the distance vector
-    // to a vector of distances
-    std::for_each(occurences.begin(), occurences.end(), [&](const auto& entry) {
-        const std::string& word = entry.first;
-
-        std::vector<int>& dist = distances[word];
-        int index = 0;
-        std::transform(dist.begin(), dist.end(), dist.begin(), [&index](int) { return index++; });
-    });
-
-    return distances;
-};
-
-/// @brief Pure function to calculate the density of a word in a chapter
-/// @param occurrences A map of words to their counts
-/// @param totalWordsInChapter The total number of words in the chapter
-/// @return The density of the word in the chapter
-auto calculateDensity = [](const std::unordered_map<std::string, int>& occurrences, int totalWordsInChapter) {
-    double totalOccurrences = std::accumulate(occurrences.begin(), occurrences.end(), 0,
-        [](const int previous, const std::pair<std::string, int>& p) { return previous + p.second; });
-    return totalWordsInChapter > 0 ? totalOccurrences / totalWordsInChapter : 0.0;
-};
-
-/// @brief Pure function to count occurences of words in a word list
-/// @param words The list of words to count
-/// @return A map of words to their counts
-auto countOccurences = [](const std::vector<std::string>& words) {
-    // Map step: Transform words into pairs of (word, 1)
-    // As such all pairs are initialized with a count of 1
-    auto map = [](const std::string& word) {
-        return std::make_pair(word, 1);
-    };
-
-    // Transform the words into pairs
-    std::vector<std::pair<std::string, int>> pairs;
-    std::transform(words.begin(), words.end(), std::back_inserter(pairs), map);
-
-    // Reduce step: Reduce the pairs into a map of words to their counts
-    auto reduce = [](std::unordered_map<std::string, int>& result, const std::pair<std::string, int>& pair) {
-        result[pair.first] += pair.second;
-    };
-
-    // Iterate over each element in the pairs vector and reduce them using reduce function
-    // as such updating the counts of words in the result map.
-    std::unordered_map<std::string, int> result;
-    std::for_each(pairs.begin(), pairs.end(), std::bind(reduce, std::ref(result), std::placeholders::_1));
-
-    return result;
-};
-
-/// @brief Pure function to filter words from a word list
-/// @param wordList The list of all words to filter
-/// @param filterList The list of words to filter out
-/// @return The filtered list of words
-auto filterWords = [](const std::vector<std::string>& filterList) {
-    return [filterList](const std::vector<std::string>& wordList) {
-        std::vector<std::string> result;
-
-        // if the word from wordList is in filterList, copy it to result
-        std::copy_if(wordList.begin(), wordList.end(), std::back_inserter(result), [&filterList](const std::string& word) {
-            return std::find(filterList.begin(), filterList.end(), word) != filterList.end();
-        });
-
-        return result;
-    };
-};
-
-
-
-// Pure function to read files
-/// @brief Read file contents into a string
-/// @param fileName The name of the file to read
-/// @return The contents of the file
-auto readFile = [](const std::string& fileName) -> std::optional<std::string> {
-    std::ifstream file(fileName);
-    if (!file.is_open()) {
-        return std::nullopt;
-    }
-    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
-};
-
-/// @brief Tokenize the input text
-/// @param optionalInputText The input text to tokenize
-/// @return A vector of tokens
-auto tokenize = [](const std::optional<std::string>& optionalInputText) -> std::vector<std::string> {
-    if (!optionalInputText) {
-        return {}; // Return an empty vector if there's no input text
-    }
-
-    const std::string& inputText = *optionalInputText;
-    // Replace "CHAPTER <number>" with "CHAPTER_<number>"
-    std::regex chapterPattern(R"(CHAPTER (\d+))");
-    std::string processedText = std::regex_replace(inputText, chapterPattern, "CHAPTER_$1");
-    
-    std::istringstream stream(processedText);
-    const std::vector<std::string> tokens((std::istream_iterator<std::string>(stream)), std::istream_iterator<std::string>());
-
-    // Map step: Transform tokens
-    const auto filteredTokens = [&tokens]() {
-        std::vector<std::string> result;
-        std::transform(tokens.begin(), tokens.end(), std::back_inserter(result),
-                       [](const std::string& token) {
-                           std::string filtered;
-                           std::copy_if(token.begin(), token.end(), std::back_inserter(filtered),
-                                        [](char c) { return std::isalpha(c) || std::isdigit(c) || c == '_'; });
-                           return filtered;
-                       });
-        return result;
-    }();
-
-    // Reduce step: Filter out empty tokens
-    const auto nonEmptyTokens = [&filteredTokens]() {
-        std::vector<std::string> result;
-        std::copy_if(filteredTokens.begin(), filteredTokens.end(), std::back_inserter(result),
-                     [](const std::string& token) { return !token.empty(); });
-        return result;
-    }();
-
-    return nonEmptyTokens;
-};
-
-/// @brief Split the tokens by chapter
-/// @param tokens The tokens to split
-/// @return A map of chapter numbers to their tokens
-auto splitByChapter = [](const std::vector<std::string>& tokens) {
-    std::map<int, std::vector<std::string>> chapters;
-    std::regex chapterPattern(R"(CHAPTER_\d+)");
-    int chapterIndex = 0;
-
-    // Use std::for_each to iterate over the tokens
-    std::for_each(tokens.begin(), tokens.end(), [&chapters, &chapterIndex, &chapterPattern](const std::string& token) {
-        if (std::regex_match(token, chapterPattern)) {
-            // Start a new chapter
-            chapterIndex++;
-        } else {
-            // Add token to the current chapter's vector
-            chapters[chapterIndex].push_back(token);
-        }
-    });
+#include "textual_tide.h"
+#include "document.h"
+#include "tokenizer.h"
+#include "symbols.h"
+#include "chapters.h"
+#include "lexicon.h"
+#include "phrases.h"
+#include "perfect_hash.h"
+#include "builtin_terms.h"
+#include "lexicon_file.h"
+#include "counting.h"
+#include "scheduler.h"
+#include "pipeline.h"
+#include "generator.h"
+#include "combinators.h"
+#include "inverted_index.h"
+#include "profile.h"
+#include "proximity.h"
+#include "kde.h"
 
-    // If the first token is not a chapter and chapterIndex is still 0, remove the entry.
-    if (chapterIndex == 0) {
-        chapters.erase(chapterIndex);
-    }
-
-    return chapters;
-};
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
 
 TEST_CASE("calculateDistances with empty input") {
-    std::unordered_map<std::string, int> emptyMap;
+    std::unordered_map<std::string, std::vector<int>> emptyMap;
     auto result = calculateDistances(emptyMap);
 
     CHECK(result.empty());
 }
 
 TEST_CASE("calculateDistances with non-empty input") {
-    std::unordered_map<std::string, int> inputMap = {
-        {"apple", 3},
-        {"orange", 2},
-        {"banana", 4}
+    std::unordered_map<std::string, std::vector<int>> inputMap = {
+        {"apple", {2, 5, 11}},
+        {"orange", {7}},
+        {"banana", {0, 1, 3, 10}}
     };
     auto result = calculateDistances(inputMap);
 
     CHECK(result.size() == inputMap.size());
 
-    // Check distances for each word
-    CHECK(result["apple"] == std::vector<int>{0, 1, 2});
-    CHECK(result["orange"] == std::vector<int>{0, 1});
-    CHECK(result["banana"] == std::vector<int>{0, 1, 2, 3});
+    // Check the gaps between consecutive positions of each word
+    CHECK(result["apple"] == std::vector<int>{3, 6});
+    CHECK(result["orange"].empty());
+    CHECK(result["banana"] == std::vector<int>{1, 2, 7});
+}
+
+TEST_CASE("calculateProximityDensity weighs clustered occurences higher") {
+    const std::map<std::string, std::vector<int>> clustered = {{"war", {0, 1, 2}}};
+    const std::map<std::string, std::vector<int>> scattered = {{"war", {0, 10, 20}}};
+
+    CHECK(calculateProximityDensity(clustered, 30) == doctest::Approx((3.0 + 1.0 + 1.0) / 30.0));
+    CHECK(calculateProximityDensity(scattered, 30) == doctest::Approx((3.0 + 0.1 + 0.1) / 30.0));
+    CHECK(calculateProximityDensity(std::map<std::string, std::vector<int>>{}, 30) == 0.0);
+    CHECK(calculateProximityDensity(clustered, 0) == 0.0);
 }
 
 TEST_CASE("calculateDensity with empty occurrences") {
@@ -264,6 +119,9 @@ TEST_CASE("filterWords with non-empty filterList") {
 
     CHECK(result[0] == "apple");
     CHECK(result[1] == "banana");
+
+    const auto fromSpan = filterFunction(spanOf(wordList, TokenRange{1, 4}));
+    CHECK(fromSpan == std::vector<std::string>{"banana"});
 }
 
 TEST_CASE("tokenize with empty optionalInputText") {
@@ -291,3 +149,928 @@ TEST_CASE("tokenize with non-empty optionalInputText") {
     CHECK(result[9] == "Dog");
 }
 
+TEST_CASE("mapFile with missing file") {
+    auto result = mapFile("does_not_exist.txt");
+
+    CHECK_FALSE(result.has_value());
+}
+
+TEST_CASE("mapFile with existing file") {
+    const std::string fileName = "test_document.tmp";
+    std::ofstream(fileName) << "CHAPTER 1 War and Peace";
+
+    auto result = mapFile(fileName);
+    std::remove(fileName.c_str());
+
+    REQUIRE(result.has_value());
+    CHECK(result->text() == "CHAPTER 1 War and Peace");
+}
+
+TEST_CASE("tokenize strips punctuation and joins chapter markers") {
+    std::optional<std::string> inputText = "CHAPTER 12 \"Well, Prince--don't you...\" said CHAPTER_3; x CHAPTER  4 -- ...";
+    auto result = tokenize(inputText);
+
+    const std::vector<std::string> expected = {"CHAPTER_12", "Well", "Princedont", "you", "said", "CHAPTER_3", "x", "CHAPTER", "4"};
+    REQUIRE(result.size() == expected.size());
+    for (std::size_t i = 0; i < expected.size(); ++i) {
+        CHECK(result[i] == expected[i]);
+    }
+}
+
+TEST_CASE("tokenizeView points into the source text") {
+    const std::string inputText = "\"Well, Prince,\" she said";
+    auto result = tokenizeView(inputText);
+
+    REQUIRE(result.size() == 4);
+    CHECK(result[0] == "Well");
+    CHECK(result[1] == "Prince");
+    CHECK(result[0].data() == inputText.data() + 1);
+    CHECK(result[3].data() == inputText.data() + inputText.size() - 4);
+}
+
+TEST_CASE("ChapterSplitter matches splitByChapter for any chunk size") {
+    const std::string content = "Preface text. CHAPTER 1 The Quick, brown fox. CHAPTER 2\nJumps-over the \"lazy\" dog. CHAPTER 3";
+
+    const auto tokens = tokenizeView(content);
+    const auto chapters = splitByChapter(tokens);
+    std::map<int, std::vector<std::string_view>> expected;
+    for (int chapterNum = 0; chapterNum <= chapters.lastChapter(); ++chapterNum) {
+        const auto chapterContent = spanOf(tokens, chapters.ranges[chapterNum]);
+        if (!chapterContent.empty()) {
+            expected[chapterNum] = std::vector<std::string_view>(chapterContent.begin(), chapterContent.end());
+        }
+    }
+
+    for (std::size_t chunkSize : {1, 3, 8, 1024}) {
+        std::map<int, std::vector<std::string>> result;
+        auto onChapter = [&result](int chapterNum, const TokenList& chapterContent) {
+            result[chapterNum] = std::vector<std::string>(chapterContent.begin(), chapterContent.end());
+        };
+        ChapterSplitter splitter;
+        for (std::size_t offset = 0; offset < content.size(); offset += chunkSize) {
+            splitter.feed(std::string_view(content).substr(offset, chunkSize), false, onChapter);
+        }
+        splitter.feed({}, true, onChapter);
+
+        REQUIRE(result.size() == expected.size());
+        for (const auto& [chapterNum, chapterContent] : expected) {
+            CHECK(result[chapterNum] == std::vector<std::string>(chapterContent.begin(), chapterContent.end()));
+        }
+    }
+}
+
+TEST_CASE("classifier kernels agree with the character table") {
+    std::string block(64, ' ');
+    for (std::size_t i = 0; i < block.size(); ++i) {
+        block[i] = static_cast<char>(i * 37 + 11);
+    }
+
+    const auto expected = classifyBlockScalar(block.data());
+    for (const auto& [name, classify] : availableClassifiers()) {
+        const auto result = classify(block.data());
+        CHECK_MESSAGE(result.word == expected.word, name);
+        CHECK_MESSAGE(result.separator == expected.separator, name);
+    }
+}
+
+TEST_CASE("scanTokensWith gives the same tokens with every kernel") {
+    std::string inputText;
+    for (int i = 0; i < 40; ++i) {
+        inputText += "CHAPTER " + std::to_string(i) + "\n\"Well, Prince--don't\tyou...\" said_she \xc3\xa9t\xc3\xa9 ";
+    }
+
+    auto scanAll = [&inputText](BlockClassifier classify) {
+        std::vector<std::string> tokens;
+        std::string scratch;
+        scanTokensWith(classify, inputText, true, scratch, [&tokens](std::string_view token, bool) {
+            tokens.emplace_back(token);
+        });
+        return tokens;
+    };
+
+    const auto expected = scanAll(classifyBlockScalar);
+    CHECK(expected.size() == 40 * 6);
+    for (const auto& [name, classify] : availableClassifiers()) {
+        CHECK_MESSAGE(scanAll(classify) == expected, name);
+    }
+}
+
+TEST_CASE("SymbolTable interns every token once") {
+    SymbolTable symbols;
+    const std::vector<std::string> words = {"war", "peace", "war", "battle", "peace"};
+    const auto ids = internTokens(symbols, words);
+
+    CHECK(ids == std::vector<TermId>{0, 1, 0, 2, 1});
+    CHECK(symbols.size() == 3);
+    CHECK(symbols.name(2) == "battle");
+    CHECK(symbols.find("peace") == std::optional<TermId>(1));
+    CHECK_FALSE(symbols.find("treaty").has_value());
+}
+
+TEST_CASE("splitByChapter builds an offset index") {
+    const std::vector<std::string> tokens = {"Preface", "CHAPTER_1", "The", "fox", "CHAPTER_2", "CHAPTER_3", "dog", "CHAPTER_x"};
+    auto result = splitByChapter(tokens);
+
+    REQUIRE(result.lastChapter() == 3);
+    CHECK(spanOf(tokens, result.ranges[0]).size() == 1);
+    CHECK(spanOf(tokens, result.ranges[1])[1] == "fox");
+    CHECK(result.ranges[2].empty());
+    CHECK(spanOf(tokens, result.ranges[3]).size() == 2);  // "CHAPTER_x" is not a marker
+}
+
+TEST_CASE("tokenizeChapters finds the same chapters as splitByChapter") {
+    const std::string inputText = "Preface. CHAPTER 1 The quick fox. CHAPTER 2\n\nCHAPTER 3 The lazy dog.";
+    auto result = tokenizeChapters(inputText);
+    auto expected = splitByChapter(tokenizeView(inputText));
+
+    REQUIRE(result.chapters.ranges.size() == expected.ranges.size());
+    for (std::size_t i = 0; i < expected.ranges.size(); ++i) {
+        CHECK(result.chapters.ranges[i].begin == expected.ranges[i].begin);
+        CHECK(result.chapters.ranges[i].end == expected.ranges[i].end);
+    }
+    CHECK(spanOf(result.tokens, result.chapters.ranges[3])[2] == "dog");
+}
+
+TEST_CASE("buildSectionIndex restarts chapter numbers in every book") {
+    const std::string inputText =
+        "Preface. BOOK ONE: 1805 CHAPTER 1 war battle CHAPTER 2 peace "
+        "BOOK TWO: 1806 CHAPTER 1 treaty CHAPTER 2 calm rest "
+        "FIRST EPILOGUE: 1813 CHAPTER 1 home";
+    const auto chapteredTokens = tokenizeChapters(inputText);
+    const auto result = buildSectionIndex(chapteredTokens);
+    auto tokensOf = [&chapteredTokens](TokenRange range) {
+        const auto span = spanOf(chapteredTokens.tokens, range);
+        return std::vector<std::string>(span.begin(), span.end());
+    };
+
+    REQUIRE(chapteredTokens.headings.size() == 3);
+    CHECK(chapteredTokens.headings[2].part == Part::Epilogue);
+
+    const Section* bookOneChapterTwo = result.find(Part::Book, 1, 2);
+    REQUIRE(bookOneChapterTwo != nullptr);
+    CHECK(bookOneChapterTwo->flatChapter == 2);
+    CHECK(tokensOf(bookOneChapterTwo->range) == std::vector<std::string>{"peace"});
+
+    const Section* bookTwoChapterTwo = result.find(Part::Book, 2, 2);
+    REQUIRE(bookTwoChapterTwo != nullptr);
+    CHECK(tokensOf(bookTwoChapterTwo->range) == std::vector<std::string>{"calm", "rest"});
+
+    const Section* epilogue = result.find(Part::Epilogue, 1, 1);
+    REQUIRE(epilogue != nullptr);
+    CHECK(tokensOf(epilogue->range) == std::vector<std::string>{"home"});
+
+    CHECK(result.find(Part::Book, 2, 3) == nullptr);
+    CHECK(tokensOf(result.bookRange(Part::Book, 2)) ==
+          std::vector<std::string>{"1806", "CHAPTER_1", "treaty", "CHAPTER_2", "calm", "rest"});
+
+    // A number longer than maxChapterDigits is no heading, it stays a word of the chapter
+    CHECK(chapterNumberOf("CHAPTER_9999") == 9999);
+    CHECK_FALSE(isChapterMarker("CHAPTER_99999999999"));
+    const auto overlong = buildSectionIndex(tokenizeChapters("BOOK ONE: 1805 CHAPTER 1 war CHAPTER 99999999999 peace"));
+    const Section* onlyChapter = overlong.find(Part::Book, 1, 1);
+    REQUIRE(onlyChapter != nullptr);
+    CHECK(onlyChapter->range.size() == 3);
+}
+
+TEST_CASE("TermSet membership") {
+    std::vector<std::string> terms;
+    for (int i = 0; i < 5000; ++i) {
+        terms.push_back("term" + std::to_string(i));
+    }
+    terms.push_back("term42");
+    const TermSet result(terms);
+
+    CHECK(result.size() == 5000);
+    CHECK(result.contains("term0"));
+    CHECK(result.contains("term4999"));
+    CHECK_FALSE(result.contains("term5000"));
+    CHECK_FALSE(result.contains(""));
+    CHECK_FALSE(TermSet().contains("term0"));
+}
+
+TEST_CASE("matchCategories labels every token in one pass") {
+    SymbolTable symbols;
+    CategoryMatcher matcher;
+    matcher.addCategory(symbols, "war", std::vector<std::string>{"battle", "army", "fire"});
+    matcher.addCategory(symbols, "peace", std::vector<std::string>{"calm", "home", "fire"});
+    const auto ids = internTokens(symbols, std::vector<std::string>{"the", "army", "sat", "by", "the", "fire", "at", "home"});
+    const auto result = matchCategories(matcher, ids);
+
+    CHECK(matcher.categoryCount() == 2);
+    CHECK(result.counts == std::vector<int>{2, 2});
+    CHECK(result.positions[0] == std::vector<std::uint32_t>{1, 5});
+    CHECK(result.positions[1] == std::vector<std::uint32_t>{5, 7});
+    CHECK(categoryDensity(result, 0, ids.size()) == doctest::Approx(2.0 / 8.0));
+}
+
+TEST_CASE("readLexiconEntries reads one entry per line") {
+    const auto result = readLexiconEntries("battle\nfield marshal\n\ncease-fire\r\n  army  \nlast");
+
+    CHECK(result == std::vector<std::vector<std::string>>{{"battle"}, {"field", "marshal"}, {"ceasefire"}, {"army"}, {"last"}});
+}
+
+TEST_CASE("matchPhrases finds overlapping phrases in one pass") {
+    SymbolTable symbols;
+    const std::vector<PhraseEntry> entries = {
+        {{"she", "sells"}, 0}, {{"sells", "sea", "shells"}, 1}, {{"sea", "shells"}, 0}, {{"he", "sells", "sea"}, 1}};
+    const auto automaton = buildPhraseAutomaton(symbols, entries);
+    const auto ids = internTokens(symbols, std::vector<std::string>{
+        "she", "sells", "sea", "shells", "he", "sells", "sea", "sea", "shells", "she"});
+    const auto result = matchPhrases(automaton, ids);
+
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> found;
+    std::transform(result.begin(), result.end(), std::back_inserter(found),
+                   [](const PhraseMatch& match) { return std::make_pair(match.phrase, match.position); });
+    CHECK(found == std::vector<std::pair<std::uint32_t, std::uint32_t>>{{0, 0}, {1, 1}, {2, 2}, {3, 4}, {2, 7}});
+    CHECK(matchPhrases(PhraseAutomaton{}, ids).empty());
+
+    CategoryMatcher matcher;
+    matcher.addCategory(symbols, "a", std::vector<std::string>{"he"});
+    matcher.addCategory(symbols, "b", std::vector<std::string>{"shells"});
+    auto hits = matchCategories(matcher, ids);
+    addPhraseHits(hits, automaton, result);
+    CHECK(hits.counts == std::vector<int>{4, 4});
+    CHECK(hits.positions[0] == std::vector<std::uint32_t>{1, 3, 4, 8});
+    CHECK(hits.positions[1] == std::vector<std::uint32_t>{3, 3, 6, 8});
+}
+
+TEST_CASE("buildPerfectHash places every key in its own slot") {
+    std::vector<std::string> keys;
+    for (int i = 0; i < 1000; ++i) {
+        keys.push_back("key" + std::to_string(i));
+    }
+    const auto layout = buildPerfectHash(keys);
+    const std::size_t mask = layout.slotKeys.size() - 1;
+
+    CHECK((layout.slotKeys.size() & mask) == 0);
+    for (std::size_t key = 0; key < keys.size(); ++key) {
+        const std::uint64_t hash = hashToken(keys[key]);
+        const std::uint32_t displacement = layout.displacements[perfectHashBucket(hash, layout.displacements.size())];
+        CHECK(layout.slotKeys[perfectHashSlot(hash, displacement, mask)] == static_cast<std::int32_t>(key));
+    }
+    CHECK(buildPerfectHash({}).slotKeys.size() == 8);
+}
+
+TEST_CASE("builtinTerms holds the war and peace terms") {
+    static_assert(std::all_of(builtinTerms.begin(), builtinTerms.end(), [](const StaticLexiconEntry& term) {
+        return term.category < builtinCategoryNames.size() && !term.text.empty();
+    }));
+
+    CHECK(builtinCategoryNames == std::array<std::string_view, 2>{"war", "peace"});
+    auto wordsOf = [](std::size_t category) {
+        std::vector<std::string> words;
+        for (const StaticLexiconEntry& term : builtinTerms) {
+            if (term.category == category) words.emplace_back(term.text);
+        }
+        return words;
+    };
+    auto listWords = [](const std::string& fileName) {
+        std::vector<std::string> words;
+        for (const auto& entry : readLexiconEntries(readFile(fileName).value_or(""))) {
+            if (entry.size() == 1) words.push_back(entry.front());
+        }
+        return words;
+    };
+    CHECK(wordsOf(0) == listWords("war_terms.txt"));
+    CHECK(wordsOf(1) == listWords("peace_terms.txt"));
+
+    // Phrases are stored split into their words, back to back
+    static_assert(std::all_of(builtinPhrases.begin(), builtinPhrases.end(), [](const StaticPhrase& phrase) {
+        return phrase.category < builtinCategoryNames.size() && phrase.length > 1 && phrase.first + phrase.length <= builtinPhraseWords.size();
+    }));
+    std::vector<std::vector<std::string>> phrases;
+    for (const StaticPhrase& phrase : builtinPhrases) {
+        const auto words = builtinPhraseWords.begin() + static_cast<std::ptrdiff_t>(phrase.first);
+        phrases.emplace_back(words, words + static_cast<std::ptrdiff_t>(phrase.length));
+    }
+    std::vector<std::vector<std::string>> listPhrases;
+    for (const std::string fileName : {"war_terms.txt", "peace_terms.txt"}) {
+        for (auto& entry : readLexiconEntries(readFile(fileName).value_or(""))) {
+            if (entry.size() > 1) listPhrases.push_back(std::move(entry));
+        }
+    }
+    CHECK(phrases == listPhrases);
+}
+
+TEST_CASE("LexiconFile matches like the word lists it was compiled from") {
+    const std::string fileName = "test_lexicon.tmp";
+    const auto compiled = compileLexicon({{"war", "battle\nfield marshal\narmy\n"}, {"peace", "home\narmy\nquiet field\n"}});
+    REQUIRE(writeLexiconFile(fileName, compiled));
+    const auto lexicon = LexiconFile::open(fileName);
+    REQUIRE(lexicon);
+
+    CHECK(lexicon->categoryCount() == 2);
+    CHECK(lexicon->name(1) == "peace");
+    CHECK(lexicon->wordCount() == 6);
+    CHECK(lexicon->maskOf(*lexicon->find("army")) == 3);
+    CHECK(lexicon->maskOf(*lexicon->find("field")) == 0);
+    CHECK_FALSE(lexicon->find("navy"));
+
+    const std::vector<std::string> tokens = {"the", "field", "marshal", "left", "home", "for", "the", "quiet", "field", "army"};
+    const auto ids = lexicon->termIds(tokens);
+    auto hits = matchCategories(*lexicon, ids);
+    addPhraseHits(hits, lexicon->phrases(), matchPhrases(lexicon->phrases(), ids));
+    CHECK(hits.counts == std::vector<int>{2, 3});
+    CHECK(hits.positions[0] == std::vector<std::uint32_t>{2, 9});
+    CHECK(hits.positions[1] == std::vector<std::uint32_t>{4, 8, 9});
+    std::remove(fileName.c_str());
+}
+
+TEST_CASE("LexiconFile rejects files that are no lexicons") {
+    const std::string fileName = "test_lexicon.tmp";
+    std::ofstream(fileName) << "battle\narmy\n";
+    CHECK_FALSE(LexiconFile::open(fileName));
+    CHECK_FALSE(LexiconFile::open("missing.ttlex"));
+    std::remove(fileName.c_str());
+}
+
+TEST_CASE("LexiconFile rejects files with indices out of range") {
+    const std::string fileName = "test_lexicon.tmp";
+    const auto compiled = compileLexicon({{"war", "battle\nfield marshal\narmy\n"}, {"peace", "home\narmy\nquiet field\n"}});
+    REQUIRE(writeLexiconFile(fileName, compiled));
+    const std::string image = readFile(fileName).value();
+    LexiconFileHeader header;
+    std::memcpy(&header, image.data(), sizeof(header));
+
+    // Start of every array in file order, each at a multiple of 8 bytes
+    const std::vector<std::pair<std::size_t, std::size_t>> arrays = {
+        {header.bucketCount, 4},      {header.slotCount, 4},      {header.wordCount, 8},       {header.wordCount + 1, 4},
+        {header.categoryCount + 1, 4}, {header.stateCount + 1, 4}, {header.edgeCount, 4},       {header.edgeCount, 4},
+        {header.stateCount, 4},       {header.stateCount + 1, 4}, {header.outputCount, 4},     {header.rootNextCount, 4},
+        {header.phraseCount, 8}};
+    std::vector<std::size_t> starts;
+    std::size_t offset = sizeof(header);
+    for (const auto& [count, size] : arrays) {
+        offset = (offset + 7) / 8 * 8;
+        starts.push_back(offset);
+        offset += count * size;
+    }
+    enum { SlotWords = 1, Masks = 2, WordOffsets = 3, EdgeTargets = 7, Fail = 8, Outputs = 10, RootNext = 11, Phrases = 12 };
+
+    // Open a copy of the file with one 32 bit value replaced
+    auto openPatched = [&](std::size_t array, std::size_t byte, std::uint32_t value) {
+        std::string patched = image;
+        std::memcpy(patched.data() + starts[array] + byte, &value, sizeof(value));
+        std::ofstream(fileName, std::ios::binary) << patched;
+        return LexiconFile::open(fileName).has_value();
+    };
+
+    CHECK(LexiconFile::open(fileName));
+    CHECK_FALSE(openPatched(SlotWords, 0, header.wordCount));
+    CHECK_FALSE(openPatched(Masks, 0, 4));
+    CHECK_FALSE(openPatched(WordOffsets, 0, 1000));
+    CHECK_FALSE(openPatched(EdgeTargets, 0, header.stateCount));
+    CHECK_FALSE(openPatched(EdgeTargets, 0, 0));
+    CHECK_FALSE(openPatched(Fail, 4, header.stateCount));
+    CHECK_FALSE(openPatched(Fail, 4, 1));
+    CHECK_FALSE(openPatched(Outputs, 0, header.phraseCount));
+    CHECK_FALSE(openPatched(RootNext, 0, header.stateCount));
+    CHECK_FALSE(openPatched(Phrases, 0, 2));
+    CHECK_FALSE(openPatched(Phrases, 4, 0));
+    std::remove(fileName.c_str());
+}
+
+TEST_CASE("FlatCountMap counts many keys and owns them") {
+    FlatCountMap<std::string_view> result;
+    {
+        std::vector<std::string> words;
+        for (int i = 0; i < 3000; ++i) {
+            words.push_back("word" + std::to_string(i % 1000));
+        }
+        std::for_each(words.begin(), words.end(), [&result](const std::string& word) { ++result[word]; });
+    }
+
+    CHECK(result.size() == 1000);
+    CHECK(result.countOf("word0") == 3);
+    CHECK(result.countOf("word999") == 3);
+    CHECK(result.countOf("word1000") == 0);
+    CHECK(result.begin()->first == "word0");
+    CHECK(calculateDensity(result, 6000) == doctest::Approx(0.5));
+}
+
+TEST_CASE("countOccurences counts term ids") {
+    const std::vector<TermId> ids = {7, 3, 7, 0, 7, 3};
+    const auto result = countOccurences(ids);
+
+    CHECK(result.size() == 3);
+    CHECK(result.countOf(7) == 3);
+    CHECK(result.countOf(3) == 2);
+    CHECK(result.countOf(0) == 1);
+    CHECK(result.countOf(1) == 0);
+}
+
+TEST_CASE("countOccurencesParallel equals the serial count") {
+    std::vector<std::string> words;
+    for (int i = 0; i < 100000; ++i) {
+        words.push_back("w" + std::to_string((i * 7919) % 4099));
+    }
+    const auto serial = countOccurences(words);
+
+    for (unsigned threads : {1u, 2u, 3u, 5u, 8u}) {
+        ThreadPool pool(threads);
+        const auto result = countOccurencesParallel(words, pool);
+        REQUIRE(result.size() == serial.size());
+        CHECK(std::equal(result.begin(), result.end(), serial.begin()));
+    }
+    ThreadPool pool;
+    CHECK(countOccurencesParallel(std::vector<std::string>{}, pool).empty());
+}
+
+TEST_CASE("parallelForLargestFirst runs every task once") {
+    std::vector<std::size_t> sizes = {5, 500, 1, 0, 80, 80, 3000, 7};
+    for (unsigned threads : {1u, 3u, 16u}) {
+        ThreadPool pool(threads);
+        std::vector<std::atomic<int>> runs(sizes.size());
+        std::vector<std::size_t> startOrder;
+        std::mutex orderMutex;
+        parallelForLargestFirst(pool, sizes.size(), [&sizes](std::size_t task) { return sizes[task]; }, [&](std::size_t task) {
+            ++runs[task];
+            const std::lock_guard<std::mutex> lock(orderMutex);
+            startOrder.push_back(task);
+        });
+
+        CHECK(std::all_of(runs.begin(), runs.end(), [](const std::atomic<int>& count) { return count == 1; }));
+        if (threads == 1) {
+            CHECK(startOrder == std::vector<std::size_t>{6, 1, 4, 5, 7, 0, 2, 3});
+        }
+    }
+    ThreadPool pool(4);
+    parallelForLargestFirst(pool, 0, [](std::size_t) { return 0; }, [](std::size_t) { CHECK(false); });
+}
+
+TEST_CASE("ThreadPool runs a task graph in dependency order") {
+    ThreadPool pool(3);
+    std::atomic<int> step = 0;
+    const auto first = pool.submit([&step]() { return ++step; });
+    const auto second = pool.submit([&step]() { return ++step; });
+    const auto joined = pool.submit([&]() { return first.result.get() + second.result.get() + 10 * ++step; }, first, second);
+    const auto failing = pool.submit([]() -> int { throw std::runtime_error("stage failed"); });
+    const auto after = pool.submit([&failing]() { return failing.result.get(); }, failing);
+
+    CHECK(pool.wait(joined) == 33);
+    CHECK_THROWS_AS(pool.wait(after), std::runtime_error);
+
+    // Tasks that wait for their own subtasks help instead of blocking a worker
+    ThreadPool single(1);
+    const auto outer = single.submit([&single]() {
+        const auto inner = single.submit([]() { return 21; });
+        return 2 * single.wait(inner);
+    });
+    CHECK(single.wait(outer) == 42);
+}
+
+TEST_CASE("SpscRing hands every item over in order") {
+    SpscRing<int> ring(3);
+    int item = 1;
+    CHECK(ring.tryPush(item));
+    CHECK(ring.tryPop() == 1);
+    CHECK_FALSE(ring.tryPop());
+
+    std::thread producer([&ring]() {
+        for (int value = 0; value < 100000; ++value) {
+            ring.push(value);
+        }
+        ring.close();
+    });
+    int expected = 0;
+    bool ordered = true;
+    for (auto value = ring.pop(); value; value = ring.pop()) {
+        ordered = ordered && *value == expected++;
+    }
+    producer.join();
+
+    CHECK(ordered);
+    CHECK(expected == 100000);
+}
+
+TEST_CASE("pipelineChapters matches tokenizeChapters") {
+    const std::string fileName = "test_pipeline.tmp";
+    std::string text = "Preface words\n";
+    for (int chapter = 1; chapter <= 30; ++chapter) {
+        text += "CHAPTER " + std::to_string(chapter) + "\n" + std::string(static_cast<std::size_t>(chapter) * 37, 'x') + " peace, war!\n";
+    }
+    std::ofstream(fileName) << text;
+
+    // The whole text at once, the non-empty chapters interned in order
+    SymbolTable expectedSymbols;
+    std::vector<std::pair<int, std::vector<TermId>>> expected;
+    const auto chapteredTokens = tokenizeChapters(text);
+    for (int chapterNum = 0; chapterNum <= chapteredTokens.chapters.lastChapter(); ++chapterNum) {
+        const auto chapterTokens = spanOf(chapteredTokens.tokens, chapteredTokens.chapters.ranges[chapterNum]);
+        if (!chapterTokens.empty()) {
+            expected.emplace_back(chapterNum, internTokens(expectedSymbols, chapterTokens));
+        }
+    }
+
+    for (std::size_t chunkSize : {7, 100, 4096}) {
+        SymbolTable symbols;
+        std::vector<std::pair<int, std::vector<TermId>>> piped;
+        const bool opened = pipelineChapters(fileName, chunkSize, [&symbols](const TokenList& tokens) { return internTokens(symbols, tokens); },
+                                             [&piped](int chapterNum, const std::vector<TermId>& ids) { piped.emplace_back(chapterNum, ids); });
+        CHECK(opened);
+        CHECK(piped == expected);
+    }
+    CHECK_FALSE(pipelineChapters("missing.txt", 64, [](const TokenList&) { return std::vector<TermId>{}; }, [](int, const std::vector<TermId>&) {}));
+    CHECK_FALSE(pipelineChapters(fileName, 0, [](const TokenList&) { return std::vector<TermId>{}; }, [](int, const std::vector<TermId>&) {}));
+
+    // A failing stage stops the others and reaches the caller, while the rings are still full
+    const auto ids = [](const TokenList& tokens) { return std::vector<TermId>(tokens.size()); };
+    CHECK_THROWS_AS(pipelineChapters(fileName, 7, ids, [](int, const std::vector<TermId>&) { throw std::runtime_error("classifier"); }),
+                    std::runtime_error);
+    int idsCalls = 0;
+    CHECK_THROWS_AS(pipelineChapters(fileName, 7,
+                                     [&idsCalls](const TokenList& tokens) {
+                                         if (++idsCalls == 3) throw std::runtime_error("tokenizer");
+                                         return std::vector<TermId>(tokens.size());
+                                     },
+                                     [](int, const std::vector<TermId>&) {}),
+                    std::runtime_error);
+    std::remove(fileName.c_str());
+}
+
+TEST_CASE("Generator pipeline matches the eager functions") {
+    std::string text = "Intro, text.\n";
+    for (int chapter = 1; chapter <= 12; ++chapter) {
+        text += "CHAPTER " + std::to_string(chapter) + "\nWar and peace; war-time " + std::string(static_cast<std::size_t>(chapter) * 11, 'y') + "\n";
+    }
+    const std::string fileName = "test_generator.tmp";
+    std::ofstream(fileName) << text;
+
+    const auto eager = tokenizeView(text);
+    // A token is only valid until the next one is requested
+    std::vector<std::string> lazy;
+    for (std::string_view token : tokensOf(std::string_view(text))) {
+        lazy.emplace_back(token);
+    }
+    CHECK(std::equal(lazy.begin(), lazy.end(), eager.begin(), eager.end()));
+
+    std::vector<std::pair<int, std::size_t>> expected;
+    const auto chapters = splitByChapter(eager);
+    for (int chapterNum = 0; chapterNum <= chapters.lastChapter(); ++chapterNum) {
+        if (!chapters.ranges[chapterNum].empty()) {
+            expected.emplace_back(chapterNum, chapters.ranges[chapterNum].size());
+        }
+    }
+    for (std::size_t chunkSize : {3, 64, 4096}) {
+        std::vector<std::pair<int, std::size_t>> generated;
+        for (const ChapterTokens& chapter : chaptersOf(tokensOf(chunksOf(fileName, chunkSize)))) {
+            generated.emplace_back(chapter.number, chapter.tokens.size());
+        }
+        CHECK(generated == expected);
+    }
+
+    // tokenize -> filter -> count without an intermediate container
+    const auto counts = countOccurences(filtered(tokensOf(std::string_view(text)), [](std::string_view token) { return token == "wartime" || token == "War"; }));
+    CHECK(counts.size() == 2);
+    CHECK(counts.countOf("wartime") == 12);
+    CHECK(counts.countOf("War") == 12);
+    CHECK(chaptersOf(tokensOf(chunksOf("missing.txt", 64))).begin() == Generator<ChapterTokens>::iterator());
+    CHECK(chunksOf(fileName, 0).begin() == Generator<std::string_view>::iterator());
+    std::remove(fileName.c_str());
+}
+
+TEST_CASE("Generator rethrows the exception of its coroutine") {
+    auto failing = []() -> Generator<int> {
+        co_yield 1;
+        throw std::runtime_error("generator failed");
+    };
+    auto values = failing();
+    auto value = values.begin();
+    CHECK(*value == 1);
+    CHECK_THROWS_AS(++value, std::runtime_error);
+}
+
+TEST_CASE("Pipeline combinators match the step by step functions") {
+    const auto tokens = tokenizeView("War and peace. The war is over, peace is near; war again.");
+    const std::vector<std::string> terms = {"war", "peace", "War"};
+
+    const auto filteredWords = filterWords(terms)(tokens);
+    const double stepByStep = calculateDensity(countOccurences(filteredWords), static_cast<int>(tokens.size()));
+    const auto counted = tokens | pipes::filter(terms) | pipes::count;
+    CHECK(counted.inputs == tokens.size());
+    CHECK(counted.countOf("war") == 2);
+    CHECK(counted.countOf("peace") == 2);
+    CHECK(counted.countOf("is") == 0);
+    CHECK((tokens | pipes::filter(terms) | pipes::count | pipes::density) == doctest::Approx(stepByStep));
+    CHECK((tokens | pipes::filter(terms) | pipes::density) == doctest::Approx(stepByStep));
+    CHECK((tokens | pipes::density) == doctest::Approx(1.0));
+    CHECK((TokenList{} | pipes::filter(terms) | pipes::density) == 0.0);
+
+    // Stages compose in order and the source may be a generator
+    const auto lengths = tokensOf(std::string_view("a bb cc ddd")) | pipes::transform([](std::string_view token) { return token.size(); }) |
+                         pipes::filter([](std::size_t length) { return length > 1; }) | pipes::count;
+    CHECK(lengths.inputs == 4);
+    CHECK(lengths.countOf(2) == 2);
+    CHECK(lengths.countOf(3) == 1);
+    CHECK(lengths.countOf(1) == 0);
+}
+
+TEST_CASE("categoryDensities matches the hits of matchCategories and matchPhrases") {
+    SymbolTable symbols;
+    const std::vector<PhraseEntry> entries = {
+        {{"she", "sells"}, 0}, {{"sells", "sea", "shells"}, 1}, {{"sea", "shells"}, 0}, {{"he", "sells", "sea"}, 1}};
+    const auto automaton = buildPhraseAutomaton(symbols, entries);
+    const auto ids = internTokens(symbols, std::vector<std::string>{
+        "she", "sells", "sea", "shells", "he", "sells", "sea", "sea", "shells", "she"});
+    CategoryMatcher matcher;
+    matcher.addCategory(symbols, "a", std::vector<std::string>{"he"});
+    matcher.addCategory(symbols, "b", std::vector<std::string>{"shells"});
+
+    auto hits = matchCategories(matcher, ids);
+    addPhraseHits(hits, automaton, matchPhrases(automaton, ids));
+    const auto densities = ids | categoryDensities(matcher, automaton);
+    REQUIRE(densities.size() == 2);
+    CHECK(densities[0] == doctest::Approx(categoryDensity(hits, 0, ids.size())));
+    CHECK(densities[1] == doctest::Approx(categoryDensity(hits, 1, ids.size())));
+    CHECK((spanOf(ids, TokenRange{0, 0}) | categoryDensities(matcher, PhraseAutomaton{})) == std::vector<double>{0.0, 0.0});
+}
+
+TEST_CASE("categoryDensities with the proximity model matches calculateProximityDensity") {
+    SymbolTable symbols;
+    CategoryMatcher matcher;
+    matcher.addCategory(symbols, "war", std::vector<std::string>{"war", "battle", "cannon"});
+    matcher.addCategory(symbols, "peace", std::vector<std::string>{"peace", "ball"});
+    const auto ids = internTokens(symbols, tokenizeView("war battle and a ball then the cannon war; later peace, peace, war"));
+
+    auto hits = matchCategories(matcher, ids);
+    const std::map<std::string, std::vector<std::uint32_t>> positions = {{"war", hits.positions[0]}, {"peace", hits.positions[1]}};
+    const auto proximity = ids | categoryDensities(matcher, PhraseAutomaton{}, DensityModel::Proximity);
+    const int total = static_cast<int>(ids.size());
+    CHECK(proximity[0] == doctest::Approx(calculateProximityDensity(std::map<std::string, std::vector<std::uint32_t>>{{"war", hits.positions[0]}}, total)));
+    CHECK(proximity[1] == doctest::Approx(calculateProximityDensity(std::map<std::string, std::vector<std::uint32_t>>{{"peace", hits.positions[1]}}, total)));
+    CHECK(proximity[0] + proximity[1] == doctest::Approx(calculateProximityDensity(positions, total)));
+
+    // war at 0, 1, 7, 8, 12: gaps 1, 6, 1, 4
+    CHECK(proximity[0] == doctest::Approx((5.0 + 1.0 + 1.0 / 6 + 1.0 + 1.0 / 4) / total));
+    const auto frequency = ids | categoryDensities(matcher, PhraseAutomaton{});
+    CHECK(frequency[0] == doctest::Approx(5.0 / total));
+    CHECK(proximity[1] > frequency[1]);
+
+    // Phrases are placed at their last token by addPhraseHits as by the sink
+    const auto automaton = buildPhraseAutomaton(symbols, {{{"battle", "and", "a"}, 0}, {{"later", "peace"}, 1}});
+    auto phraseHits = matchCategories(matcher, ids);
+    addPhraseHits(phraseHits, automaton, matchPhrases(automaton, ids));
+    CHECK(phraseHits.positions[0] == std::vector<std::uint32_t>{0, 1, 3, 7, 8, 12});
+    CHECK(phraseHits.positions[1] == std::vector<std::uint32_t>{4, 10, 10, 11});
+    const auto withPhrases = ids | categoryDensities(matcher, automaton, DensityModel::Proximity);
+    CHECK(withPhrases[0] == doctest::Approx(calculateProximityDensity(std::map<std::string, std::vector<std::uint32_t>>{{"war", phraseHits.positions[0]}}, total)));
+    CHECK(withPhrases[1] == doctest::Approx(calculateProximityDensity(std::map<std::string, std::vector<std::uint32_t>>{{"peace", phraseHits.positions[1]}}, total)));
+    // war at 0, 1, 3, 7, 8, 12: gaps 1, 2, 4, 1, 4
+    CHECK(withPhrases[0] == doctest::Approx((6.0 + 1.0 + 1.0 / 2 + 1.0 / 4 + 1.0 + 1.0 / 4) / total));
+}
+
+TEST_CASE("varints round trip") {
+    std::vector<std::uint8_t> bytes;
+    const std::vector<std::uint32_t> values = {0, 1, 127, 128, 300, 16383, 16384, 0xffffffffu};
+    std::for_each(values.begin(), values.end(), [&bytes](std::uint32_t value) { appendVarint(bytes, value); });
+    CHECK(bytes.size() == 1 + 1 + 1 + 2 + 2 + 2 + 3 + 5);
+
+    const std::uint8_t* cursor = bytes.data();
+    for (std::uint32_t value : values) {
+        CHECK(readVarint(cursor) == value);
+    }
+    CHECK(cursor == bytes.data() + bytes.size());
+}
+
+TEST_CASE("PositionalIndex answers position, chapter and density queries without the text") {
+    std::string text = "Preface war.\n";
+    for (int chapter = 1; chapter <= 30; ++chapter) {
+        text += "CHAPTER " + std::to_string(chapter) + "\n";
+        for (int line = 0; line < chapter * 3; ++line) {
+            text += (line % 4 == 0 ? "war and cannon, " : "a calm ball and peace; ") + std::string(line % 7 == 0 ? "battle " : "");
+        }
+    }
+    const auto tokenized = tokenizeChapters(text);
+    SymbolTable symbols;
+    const auto ids = internTokens(symbols, tokenized.tokens);
+    const auto index = buildPositionalIndex(ids, tokenized.chapters);
+    const TermId war = *symbols.find("war");
+    const TermId peace = *symbols.find("peace");
+
+    // Every list decodes to the positions of its term, in order
+    for (TermId term = 0; term < symbols.size(); ++term) {
+        std::vector<std::uint32_t> expected;
+        for (std::uint32_t position = 0; position < ids.size(); ++position) {
+            if (ids[position] == term) expected.push_back(position);
+        }
+        CHECK(index.positions(term) == expected);
+        CHECK(index.count(term) == expected.size());
+    }
+    CHECK(index.count(static_cast<TermId>(symbols.size())) == 0);
+    CHECK(index.bytes.size() < ids.size() * 2);
+    REQUIRE(index.count(peace) > 3 * PositionalIndex::skipInterval);
+
+    // Seeking with skips lands on the first position at or after the target
+    const auto peacePositions = index.positions(peace);
+    for (std::uint32_t target : {0u, 1u, 500u, 2000u, peacePositions.back(), peacePositions.back() + 1}) {
+        PostingCursor cursor = index.postings(peace);
+        cursor.next();
+        cursor.seek(target);
+        const auto expected = std::lower_bound(peacePositions.begin() + 1, peacePositions.end(), target);
+        CHECK(cursor.done() == (expected == peacePositions.end()));
+        if (!cursor.done()) CHECK(cursor.position() == *expected);
+    }
+
+    // Chapter overlay
+    const auto& ranges = tokenized.chapters.ranges;
+    CHECK(index.chapterOf(0) == 0);
+    CHECK(index.chapterOf(static_cast<std::uint32_t>(ranges[1].begin) - 1) == -1);
+    CHECK(index.chapterOf(static_cast<std::uint32_t>(ranges[17].begin)) == 17);
+    CHECK(index.chapterOf(static_cast<std::uint32_t>(ranges[30].end) - 1) == 30);
+    const auto warCounts = index.chapterCounts(war);
+    for (std::size_t chapter = 0; chapter < ranges.size(); ++chapter) {
+        const auto chapterIds = spanOf(ids, ranges[chapter]);
+        CHECK(warCounts[chapter] == static_cast<std::uint32_t>(std::count(chapterIds.begin(), chapterIds.end(), war)));
+        CHECK(index.countIn(war, ranges[chapter]) == warCounts[chapter]);
+    }
+
+    // Gap-based density of a category in a chapter from the index alone
+    CategoryMatcher matcher;
+    matcher.addCategory(symbols, "war", std::vector<std::string>{"war", "cannon", "battle"});
+    const std::vector<TermId> warTerms = {war, *symbols.find("cannon"), *symbols.find("battle")};
+    const auto chapterIds = spanOf(ids, ranges[12]);
+    const auto positions = mergedPositions(index, warTerms, ranges[12]);
+    CHECK(std::is_sorted(positions.begin(), positions.end()));
+    // The k-way merge yields exactly the positions of all terms, also for unknown terms and empty ranges
+    for (const TokenRange range : {ranges[12], TokenRange{0, ids.size()}, TokenRange{5, 5}}) {
+        std::vector<std::uint32_t> expected;
+        for (const TermId term : warTerms) {
+            const auto termPositions = index.positions(term, range);
+            expected.insert(expected.end(), termPositions.begin(), termPositions.end());
+        }
+        std::sort(expected.begin(), expected.end());
+        CHECK(mergedPositions(index, warTerms, range) == expected);
+        CHECK(mergedPositions(index, std::vector<TermId>{warTerms[0], TermId{1u << 30}}, range) == index.positions(warTerms[0], range));
+    }
+    const double fromIndex = calculateProximityDensity(std::map<std::string, std::vector<std::uint32_t>>{{"war", positions}},
+                                                       static_cast<int>(ranges[12].size()));
+    CHECK(fromIndex == doctest::Approx((chapterIds | categoryDensities(matcher, PhraseAutomaton{}, DensityModel::Proximity))[0]));
+}
+
+TEST_CASE("densityProfile matches counting every window") {
+    SymbolTable symbols;
+    const std::vector<PhraseEntry> entries = {{{"open", "fire"}, 0}};
+    const auto automaton = buildPhraseAutomaton(symbols, entries);
+    CategoryMatcher matcher;
+    matcher.addCategory(symbols, "war", std::vector<std::string>{"war", "cannon"});
+    matcher.addCategory(symbols, "peace", std::vector<std::string>{"peace", "ball"});
+    std::string text;
+    for (int line = 0; line < 40; ++line) {
+        text += line < 20 ? "war and cannon, open fire at the bridge " : "a quiet ball in peace at home ";
+    }
+    const auto ids = internTokens(symbols, tokenizeView(text));
+
+    const auto sums = ids | categoryPrefixSums(matcher, automaton);
+    REQUIRE(sums.tokenCount() == ids.size());
+    for (std::size_t window : {1, 7, 50, 1000}) {
+        for (std::size_t stride : {1, 3, 50}) {
+            const auto profile = densityProfile(sums, window, stride);
+            const std::size_t size = std::min(window, ids.size());
+            CHECK(profile.starts.size() == (ids.size() - size) / stride + 1);
+            for (std::size_t point = 0; point < profile.starts.size(); point += 5) {
+                const auto windowIds = spanOf(ids, {profile.starts[point], profile.starts[point] + size});
+                const auto expected = windowIds | categoryDensities(matcher, PhraseAutomaton{});
+                // The phrase is counted at its last token, which every word-aligned window contains
+                const auto fire = static_cast<double>(std::count(windowIds.begin(), windowIds.end(), *symbols.find("fire")));
+                CHECK(profile.densities[0][point] == doctest::Approx(expected[0] + fire / static_cast<double>(size)));
+                CHECK(profile.densities[1][point] == doctest::Approx(expected[1]));
+            }
+        }
+    }
+    const auto profile = densityProfile(sums, 80, 80);
+    CHECK(profile.densities[0].front() > profile.densities[1].front());
+    CHECK(profile.densities[0].back() < profile.densities[1].back());
+    CHECK(densityProfile(std::vector<TermId>{} | categoryPrefixSums(matcher, automaton), 10, 5).starts.empty());
+}
+
+TEST_CASE("Proximity queries match a nested scan") {
+    // Two interleaved hit lists with clusters and long gaps
+    std::vector<std::uint32_t> war;
+    std::vector<std::uint32_t> peace;
+    std::uint32_t seed = 7;
+    for (std::uint32_t position = 0; position < 5000; ++position) {
+        seed = seed * 1103515245u + 12345u;
+        const std::uint32_t roll = (seed >> 16) % 100;
+        if (roll < (position % 1000 < 500 ? 8u : 1u)) war.push_back(position);
+        else if (roll > (position % 1000 < 500 ? 97u : 90u)) peace.push_back(position);
+    }
+
+    const auto nearest = nearestHits(war, peace);
+    REQUIRE(nearest.size() == war.size());
+    for (std::size_t hit = 0; hit < war.size(); ++hit) {
+        std::uint32_t best = ~0u;
+        for (std::uint32_t other : peace) {
+            best = std::min(best, other > war[hit] ? other - war[hit] : war[hit] - other);
+        }
+        CHECK(nearest[hit].position == war[hit]);
+        CHECK(nearest[hit].distance() == best);
+    }
+    CHECK(nearestHits(war, std::vector<std::uint32_t>{}).empty());
+
+    for (std::uint32_t distance : {0u, 1u, 5u, 40u}) {
+        std::vector<std::uint32_t> expected;
+        std::copy_if(war.begin(), war.end(), std::back_inserter(expected), [&](std::uint32_t position) {
+            return std::any_of(peace.begin(), peace.end(), [&](std::uint32_t other) {
+                return (other > position ? other - position : position - other) <= distance;
+            });
+        });
+        CHECK(hitsWithin(war, peace, distance) == expected);
+    }
+
+    // Per chapter, hits only pair with hits of their own chapter
+    ChapterIndex chapters;
+    chapters.ranges = {{0, 1000}, {1001, 1001}, {1002, 2500}, {2501, 5000}};
+    const auto byChapter = hitsWithinByChapter(chapters, war, peace, 5);
+    std::size_t total = 0;
+    for (const auto& chapter : byChapter) {
+        const TokenRange range = chapters.ranges[static_cast<std::size_t>(chapter.chapter)];
+        CHECK(chapter.positions == hitsWithin(positionsIn(war, range), positionsIn(peace, range), 5));
+        CHECK(std::all_of(chapter.positions.begin(), chapter.positions.end(),
+                          [&](std::uint32_t position) { return range.begin <= position && position < range.end; }));
+        total += chapter.positions.size();
+    }
+    CHECK(total <= hitsWithin(war, peace, 5).size());
+    CHECK(std::none_of(byChapter.begin(), byChapter.end(), [](const ChapterProximity& chapter) { return chapter.chapter == 1; }));
+    CHECK(positionsIn(std::vector<std::uint32_t>{}, {0, 10}).empty());
+}
+
+TEST_CASE("fft round trips and convolves like the direct sum") {
+    std::vector<std::complex<double>> signal(64);
+    for (std::size_t index = 0; index < signal.size(); ++index) {
+        signal[index] = {std::sin(0.3 * static_cast<double>(index)), static_cast<double>(index % 5)};
+    }
+    auto transformed = signal;
+    fft(transformed, false);
+    // The first coefficient is the sum of the signal
+    const auto sum = std::accumulate(signal.begin(), signal.end(), std::complex<double>());
+    CHECK(transformed[0].real() == doctest::Approx(sum.real()));
+    CHECK(transformed[0].imag() == doctest::Approx(sum.imag()));
+    fft(transformed, true);
+    for (std::size_t index = 0; index < signal.size(); ++index) {
+        CHECK(transformed[index].real() == doctest::Approx(signal[index].real()));
+        CHECK(transformed[index].imag() == doctest::Approx(signal[index].imag()));
+    }
+
+    // Smoothed densities equal a direct, edge-corrected convolution of the hit streams
+    SymbolTable symbols;
+    CategoryMatcher matcher;
+    matcher.addCategory(symbols, "war", std::vector<std::string>{"war"});
+    matcher.addCategory(symbols, "peace", std::vector<std::string>{"peace"});
+    matcher.addCategory(symbols, "ball", std::vector<std::string>{"ball"});
+    std::string text;
+    // Long enough for several overlap-add blocks
+    for (int word = 0; word < 9000; ++word) {
+        text += word % 7 == 0 ? (word % 3000 < 1500 ? "war " : "peace ") : word % 11 == 0 ? "ball " : "x ";
+    }
+    const auto ids = internTokens(symbols, tokenizeView(text));
+    const auto sums = ids | categoryPrefixSums(matcher, PhraseAutomaton{});
+    for (KernelShape shape : {KernelShape::Gaussian, KernelShape::Exponential}) {
+        const auto kernel = smoothingKernel(shape, 6.0);
+        CHECK(std::accumulate(kernel.begin(), kernel.end(), 0.0) == doctest::Approx(1.0));
+
+        // A kernel wider than the sequence is cut at its length and still adds up to 1
+        const auto capped = smoothingKernel(shape, 1e9, ids.size());
+        CHECK(capped.size() == 2 * ids.size() + 1);
+        CHECK(std::accumulate(capped.begin(), capped.end(), 0.0) == doctest::Approx(1.0));
+        CHECK(kernelDensities(sums, capped).front().size() == ids.size());
+        const auto curves = kernelDensities(sums, kernel);
+        REQUIRE(curves.size() == 3);
+        const auto radius = static_cast<std::ptrdiff_t>(kernel.size() / 2);
+        for (std::size_t category = 0; category < 3; ++category) {
+            for (std::ptrdiff_t token = 0; token < static_cast<std::ptrdiff_t>(ids.size()); token += 37) {
+                double weighted = 0.0;
+                double mass = 0.0;
+                for (std::ptrdiff_t offset = -radius; offset <= radius; ++offset) {
+                    const std::ptrdiff_t at = token + offset;
+                    if (at < 0 || at >= static_cast<std::ptrdiff_t>(ids.size())) continue;
+                    const double weight = kernel[static_cast<std::size_t>(offset + radius)];
+                    weighted += weight * sums.hitsIn(category, {static_cast<std::size_t>(at), static_cast<std::size_t>(at) + 1});
+                    mass += weight;
+                }
+                CHECK(curves[category][static_cast<std::size_t>(token)] == doctest::Approx(weighted / mass));
+            }
+        }
+    }
+}
+
+TEST_CASE("findTransitions reports the changes of the lead") {
+    SymbolTable symbols;
+    CategoryMatcher matcher;
+    matcher.addCategory(symbols, "war", std::vector<std::string>{"war"});
+    matcher.addCategory(symbols, "peace", std::vector<std::string>{"peace"});
+    std::string text;
+    for (int word = 0; word < 900; ++word) {
+        text += word % 5 != 0 ? "x " : word < 300 || word >= 600 ? "war " : "peace ";
+    }
+    const auto ids = internTokens(symbols, tokenizeView(text));
+    const auto curves = kernelDensities(ids | categoryPrefixSums(matcher, PhraseAutomaton{}), smoothingKernel(KernelShape::Gaussian, 20.0));
+    const auto transitions = findTransitions(curves[0], curves[1], {0, ids.size()});
+    REQUIRE(transitions.size() == 3);
+    CHECK(transitions[0].position == 0);
+    CHECK(transitions[0].toFirst);
+    CHECK(!transitions[1].toFirst);
+    CHECK(std::abs(static_cast<int>(transitions[1].position) - 300) < 5);
+    CHECK(transitions[2].toFirst);
+    CHECK(std::abs(static_cast<int>(transitions[2].position) - 600) < 5);
+    CHECK(findTransitions(std::vector<double>(10, 0.5), std::vector<double>(10, 0.5), {0, 10}).empty());
+}
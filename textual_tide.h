@@ -0,0 +1,192 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <iterator>
+#include <algorithm>
+#include <numeric>
+#include <map>
+#include <unordered_map>
+#include <functional>
+#include <optional>
+#include <memory>
+#include <cstdint>
+
+#include "tokenizer.h"
+#include "chapters.h"
+#include "lexicon.h"
+#include "counting.h"
+#include "scheduler.h"
+
+/// @brief Pure function to calculate the distances between occurences of words
+/// @param occurences A map of words (or categories) to the ascending token positions of their occurences
+/// @return A map of words to the gaps between their consecutive occurences, one less than the occurences
+inline auto calculateDistances = [](const auto& occurences) {
+    using Key = std::decay_t<decltype(occurences.begin()->first)>;
+    std::map<Key, std::vector<int>> distances;
+
+    // for each entry in occurences, the distance of every occurence to the one before it
+    std::for_each(occurences.begin(), occurences.end(), [&](const auto& entry) {
+        const auto& positions = entry.second;
+        std::vector<int>& dist = distances[entry.first];
+        if (positions.size() < 2) return;
+
+        dist.resize(positions.size() - 1);
+        std::transform(std::next(positions.begin()), positions.end(), positions.begin(), dist.begin(),
+                       [](auto position, auto previous) { return static_cast<int>(position - previous); });
+    });
+
+    return distances;
+};
+
+/// @brief Bonus of a hit for the distance to the previous hit of its category, 1 / gap
+/// Hits at the same position (a word and a phrase ending on it) count as adjacent.
+inline auto proximityBonus = [](std::int64_t gap) { return 1.0 / static_cast<double>(std::max<std::int64_t>(gap, 1)); };
+
+/// @brief Pure function to calculate the proximity-weighted density of words in a chapter
+/// Every occurence counts 1, plus 1 / gap to the previous occurence of the same word (or
+/// category), so clustered occurences weigh up to twice as much as scattered ones.
+/// @param occurences A map of words (or categories) to the ascending token positions of their occurences
+/// @param totalWordsInChapter The total number of words in the chapter
+/// @return The weighted occurences per word of the chapter
+inline auto calculateProximityDensity = [](const auto& occurences, int totalWordsInChapter) {
+    const auto distances = calculateDistances(occurences);
+    const double weight = std::accumulate(occurences.begin(), occurences.end(), 0.0, [&distances](double total, const auto& entry) {
+        const auto& gaps = distances.at(entry.first);
+        return std::accumulate(gaps.begin(), gaps.end(), total + static_cast<double>(entry.second.size()),
+                               [](double sum, int gap) { return sum + proximityBonus(gap); });
+    });
+    return totalWordsInChapter > 0 ? weight / totalWordsInChapter : 0.0;
+};
+
+/// @brief Pure function to calculate the density of a word in a chapter
+/// @param occurrences A map of words to their counts
+/// @param totalWordsInChapter The total number of words in the chapter
+/// @return The density of the word in the chapter
+inline auto calculateDensity = [](const auto& occurrences, int totalWordsInChapter) {
+    double totalOccurrences = std::accumulate(occurrences.begin(), occurrences.end(), 0,
+        [](const int previous, const auto& p) { return previous + p.second; });
+    return totalWordsInChapter > 0 ? totalOccurrences / totalWordsInChapter : 0.0;
+};
+
+/// @brief Pure function to count occurences of words in a word list
+/// @param words The list of words to count (std::string or std::string_view tokens, or term ids)
+/// @return A flat map of words (as owned views, or ids) to their counts
+inline auto countOccurences = [](const auto& words) {
+    using Word = typename std::decay_t<decltype(words)>::value_type;
+
+    // Map and reduce fused: every word is counted straight into the flat table, so no
+    // (word, 1) pair or copy of the word is made per token
+    FlatCountMap<CountKey<Word>> result;
+    std::for_each(words.begin(), words.end(), [&result](const Word& word) { ++result[word]; });
+
+    return result;
+};
+
+/// @brief Count occurences of words on a thread pool
+/// Map step: one task per worker counts a contiguous part of the words into its own table.
+/// Reduce step: neighbouring tables are merged pairwise in a tree of tasks; a merge starts as
+/// soon as both of its inputs are done, ceil(log2(parts)) merges deep. The result equals
+/// countOccurences(words), including the order of the keys.
+/// @param words The contiguous list of words to count (std::vector, TokenList or Span)
+/// @param pool The pool to count on
+/// @return A flat map of words to their counts
+inline auto countOccurencesParallel = [](const auto& words, ThreadPool& pool) {
+    // Below this many words per part, scheduling a task costs more than it saves
+    constexpr std::size_t minimumPartSize = 1 << 14;
+    const std::size_t parts = std::clamp<std::size_t>(words.size() / minimumPartSize, 1, pool.threadCount());
+
+    using Counts = decltype(countOccurences(spanOf(words, TokenRange{})));
+    std::vector<Counts> partials(parts);
+    std::vector<Task<void>> done;
+
+    // Map step: count every part into its own table
+    for (std::size_t part = 0; part < parts; ++part) {
+        done.push_back(pool.submit([&words, &partials, parts, part]() {
+            const TokenRange range = {words.size() * part / parts, words.size() * (part + 1) / parts};
+            partials[part] = countOccurences(spanOf(words, range));
+        }));
+    }
+
+    // Reduce step: at level k, table i absorbs table i + 2^k for every i divisible by 2^(k+1)
+    for (std::size_t stride = 1; stride < parts; stride *= 2) {
+        for (std::size_t left = 0; left + stride < parts; left += 2 * stride) {
+            done[left] = pool.submit([&partials, left, stride]() { partials[left].merge(partials[left + stride]); },
+                                     done[left], done[left + stride]);
+        }
+    }
+
+    pool.wait(done.front());
+    return std::move(partials.front());
+};
+
+/// @brief Pure function to filter words from a word list
+/// The filter list is turned into a hash set once; the returned function shares it immutably,
+/// so copying the function is cheap and a lookup does not depend on the size of the list.
+/// @param wordList The list of all words to filter, any range of words (vector, Span, TokenList)
+/// @param filterList The list of words to filter out
+/// @return The filtered list of words, as a vector of the word list's element type
+inline auto filterWords = [](const auto& filterList) {
+    const auto filterSet = std::make_shared<const TermSet>(filterList);
+    return [filterSet](const auto& wordList) {
+        std::vector<std::decay_t<decltype(*wordList.begin())>> result;
+
+        // if the word from wordList is in filterList, copy it to result
+        std::copy_if(wordList.begin(), wordList.end(), std::back_inserter(result), [&filterSet](const auto& word) {
+            return filterSet->contains(word);
+        });
+
+        return result;
+    };
+};
+
+
+
+// Pure function to read files
+/// @brief Read file contents into a string
+/// @param fileName The name of the file to read
+/// @return The contents of the file
+inline auto readFile = [](const std::string& fileName) -> std::optional<std::string> {
+    std::ifstream file(fileName);
+    if (!file.is_open()) {
+        return std::nullopt;
+    }
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+};
+
+/// @brief Tokenize the input text
+/// Replaces "CHAPTER <number>" with "CHAPTER_<number>", strips punctuation and drops empty tokens
+/// in a single pass over the text.
+/// @param optionalInputText The input text to tokenize, has to outlive the returned tokens
+/// @return The tokens, as views into the input text
+inline auto tokenize = [](const std::optional<std::string>& optionalInputText) -> TokenList {
+    if (!optionalInputText) {
+        return {}; // Return an empty list if there's no input text
+    }
+
+    return tokenizeView(*optionalInputText);
+};
+
+/// @brief Split the tokens by chapter
+/// Nothing is copied, the chapters are offsets into tokens; use spanOf to view one.
+/// @param tokens The tokens to split (std::string or std::string_view tokens)
+/// @return The offset index of the chapters
+inline auto splitByChapter = [](const auto& tokens) {
+    ChapterIndex chapters;
+    chapters.ranges.push_back({0, 0});
+
+    std::size_t position = 0;
+    std::for_each(tokens.begin(), tokens.end(), [&chapters, &position](const auto& token) {
+        if (isChapterMarker(token)) {
+            // Close the current chapter, the next one starts after the marker
+            chapters.ranges.back().end = position;
+            chapters.ranges.push_back({position + 1, position + 1});
+        }
+        ++position;
+    });
+    chapters.ranges.back().end = position;
+
+    return chapters;
+};
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "char_classify.h"
+
+/// @brief Bump allocator for the few tokens that cannot be a view into the source text
+/// Blocks are never moved or freed before the arena itself, so handed out views stay valid
+/// when the arena (or the TokenList owning it) is moved.
+class TokenArena {
+public:
+    /// @brief Copy text into the arena
+    /// @param text The text to copy
+    /// @return A view of the copy, valid for the lifetime of the arena
+    std::string_view store(std::string_view text) {
+        char* target = allocate(text.size());
+        std::memcpy(target, text.data(), text.size());
+        return {target, text.size()};
+    }
+
+    /// @brief Reserve uninitialised storage inside the arena
+    /// @param size The number of bytes to reserve
+    /// @return Pointer to the reserved bytes
+    char* allocate(std::size_t size) {
+        if (size > blockSize) {
+            // Oversized requests get a block of their own, the bump block stays current
+            blocks_.push_back(std::make_unique<char[]>(size));
+            return blocks_.back().get();
+        }
+        if (current_ == nullptr || used_ + size > blockSize) {
+            blocks_.push_back(std::make_unique<char[]>(blockSize));
+            current_ = blocks_.back().get();
+            used_ = 0;
+        }
+        char* result = current_ + used_;
+        used_ += size;
+        return result;
+    }
+
+    TokenArena() = default;
+    TokenArena(const TokenArena&) = delete;
+    TokenArena& operator=(const TokenArena&) = delete;
+
+    TokenArena(TokenArena&& other) noexcept
+        : blocks_(std::move(other.blocks_)),
+          current_(std::exchange(other.current_, nullptr)),
+          used_(std::exchange(other.used_, 0)) {}
+
+    TokenArena& operator=(TokenArena&& other) noexcept {
+        blocks_ = std::move(other.blocks_);
+        current_ = std::exchange(other.current_, nullptr);
+        used_ = std::exchange(other.used_, 0);
+        return *this;
+    }
+
+private:
+    static constexpr std::size_t blockSize = 4096;
+
+    std::vector<std::unique_ptr<char[]>> blocks_;
+    char* current_ = nullptr;
+    std::size_t used_ = 0;
+};
+
+/// @brief Tokens of a text as views into that text
+/// Tokens that had to be rewritten (inner punctuation, "CHAPTER <n>" markers) live in the arena,
+/// all others point straight into the source text, which has to outlive the list.
+struct TokenList {
+    std::vector<std::string_view> tokens;
+    TokenArena arena;
+
+    using value_type = std::string_view;
+    using const_iterator = std::vector<std::string_view>::const_iterator;
+
+    std::size_t size() const { return tokens.size(); }
+    bool empty() const { return tokens.empty(); }
+    const std::string_view& operator[](std::size_t index) const { return tokens[index]; }
+    const_iterator begin() const { return tokens.begin(); }
+    const_iterator end() const { return tokens.end(); }
+};
+
+/// @brief The most digits of a chapter number; a longer number is no chapter heading
+inline constexpr std::size_t maxChapterDigits = 4;
+
+/// @brief Check if a token is a chapter marker as produced by tokenize ("CHAPTER_<number>")
+/// @param token The token to check
+/// @return True if the token announces a new chapter
+inline auto isChapterMarker = [](std::string_view token) {
+    constexpr std::string_view prefix = "CHAPTER_";
+    return token.size() > prefix.size() && token.size() <= prefix.size() + maxChapterDigits && token.substr(0, prefix.size()) == prefix &&
+        std::all_of(token.begin() + prefix.size(), token.end(), [](char c) { return c >= '0' && c <= '9'; });
+};
+
+/// @brief Scan a text once and hand every token to a callback
+/// Splits on whitespace, joins "CHAPTER <number>" into "CHAPTER_<number>", strips everything but
+/// word characters and drops tokens that end up empty, all in a single pass without allocations.
+/// Token boundaries and word characters are found 64 bytes at a time by the classify kernel.
+/// @param classify The kernel classifying the text, see availableClassifiers
+/// @param text The text to scan
+/// @param finalChunk False if more text follows, the last token is then left unconsumed
+/// @param scratch Buffer for rewritten tokens, reused between calls
+/// @param onToken Called with every token and whether it is a view into text; a rewritten token
+///                lives in scratch and is only valid during the call
+/// @return The number of bytes consumed, the rest has to be scanned again with the following text
+inline auto scanTokensWith = [](BlockClassifier classify, std::string_view text, bool finalChunk,
+                                std::string& scratch, const auto& onToken) -> std::size_t {
+    constexpr std::string_view chapterWord = "CHAPTER";
+    const std::size_t size = text.size();
+    ClassifiedText classified(text, classify);
+
+    auto endsWithChapterWord = [&text, &chapterWord](std::size_t start, std::size_t end) {
+        return end - start >= chapterWord.size() &&
+            text.compare(end - chapterWord.size(), chapterWord.size(), chapterWord) == 0;
+    };
+
+    std::size_t position = 0;
+    while (true) {
+        position = classified.nextNonSeparator(position);
+        if (position == size) {
+            return size;
+        }
+
+        // Find the end of the token
+        const std::size_t start = position;
+        bool joinedChapter = false;
+        while (true) {
+            position = classified.nextSeparator(position);
+
+            // A token touching the end of an unfinished chunk may continue in the next one,
+            // so may "CHAPTER " when the character after the space is not known yet
+            const bool undecided = position == size ||
+                (position + 1 == size && text[position] == ' ' && endsWithChapterWord(start, position));
+            if (undecided && !finalChunk) {
+                return start;
+            }
+
+            const bool joinsChapterNumber = position + 1 < size && text[position] == ' ' &&
+                text[position + 1] >= '0' && text[position + 1] <= '9' && endsWithChapterWord(start, position);
+            if (!joinsChapterNumber) {
+                break;
+            }
+            joinedChapter = true;
+            ++position;
+        }
+
+        const auto words = classified.words(start, position);
+        if (words.count == 0) {
+            continue;
+        }
+
+        // Punctuation only around the word characters: the token is a view into the text
+        if (!joinedChapter && words.last - words.first + 1 == words.count) {
+            onToken(text.substr(words.first, words.count), true);
+            continue;
+        }
+
+        // Inner punctuation ("don't") or a joined chapter marker: rewrite into scratch
+        scratch.clear();
+        std::for_each(text.begin() + words.first, text.begin() + words.last + 1, [&scratch](char c) {
+            if (isWordChar(c)) {
+                scratch.push_back(c);
+            } else if (c == ' ') {
+                scratch.push_back('_');
+            }
+        });
+        onToken(std::string_view(scratch), false);
+    }
+};
+
+/// @brief Scan a text with the widest kernel this CPU supports (classifyBlock), see scanTokensWith
+inline auto scanTokens = [](std::string_view text, bool finalChunk, std::string& scratch, const auto& onToken) {
+    return scanTokensWith(classifyBlock, text, finalChunk, scratch, onToken);
+};
+
+/// @brief Tokenize a text without copying it
+/// Produces the same tokens as tokenize, as views into text wherever possible.
+/// @param text The text to tokenize, has to outlive the returned list
+/// @return The tokens of the text
+inline auto tokenizeView = [](std::string_view text) {
+    TokenList result;
+    std::string scratch;
+
+    // Words in English prose average below six characters including the separator
+    result.tokens.reserve(text.size() / 6);
+    scanTokens(text, true, scratch, [&result](std::string_view token, bool inText) {
+        result.tokens.push_back(inText ? token : result.arena.store(token));
+    });
+
+    return result;
+};